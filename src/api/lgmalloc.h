@@ -16,11 +16,131 @@ extern "C" {
 #include <stddef.h>
 
 __attribute__((malloc, alloc_size(1)))
-void *lgmalloc(size_t size);
+void *__lgmalloc(size_t size);
+__attribute__((malloc, alloc_size(2)))
+void *__lgmalloc_class(size_t size_class, size_t size);
+
+/* Call site record the allocator reads back at init, laid
+ * out like `lgmalloc_heuristic_entry_t` and placed in the
+ * same section, see lgmalloc_heuristics.h. Every call site
+ * of `lgmalloc` gets one, counting its calls per thread,
+ * with the size when it's a compile time constant. */
+typedef struct
+{
+	size_t		size;
+	const char	*file;
+	int			line;
+	const char	*func;
+	size_t		freq;
+	int			is_const;
+}	__lgmalloc_site_t;
+
+#define __LGMALLOC_SITE_SECTION		".lgmalloc_heuristics_data"
+
+#define __LGMALLOC_TRACK_SITE(sz)											\
+	do																		\
+	{																		\
+		__attribute__((section(__LGMALLOC_SITE_SECTION), used))				\
+		static __thread __lgmalloc_site_t __lgmalloc_site = {				\
+			__builtin_constant_p(sz) ? (size_t)(sz) : 0,					\
+			__FILE__, __LINE__, __func__, 0, __builtin_constant_p(sz)		\
+		};																	\
+		++__lgmalloc_site.freq;												\
+	}	while (0)
+
+/* `lgmalloc` is a macro. Constant sizes have their default
+ * size class resolved at compile time and skip the lookup,
+ * the allocator only remaps it in case the heuristics split
+ * it. Anything else takes the regular path, as do sizes past
+ * the largest default class or the configured mmap threshold.
+ * Mirrors `__default_size_class` in lgmalloc_size_classes.h,
+ * the constants are checked against the library's own
+ * configuration when it's built, see lgmalloc.c. */
+#define __LGMALLOC_CONST_GRANULARITY	16
+#define __LGMALLOC_CONST_MAX			524288
+
+#define __LGMALLOC_CONST_BLOCKS(sz)											\
+	(((size_t)(sz) + __LGMALLOC_CONST_GRANULARITY - 1) / __LGMALLOC_CONST_GRANULARITY)
+
+#define __LGMALLOC_CONST_CLASS(sz)											\
+	(!(sz) || (size_t)(sz) > __LGMALLOC_CONST_MAX ? (size_t)0 :			\
+	 (size_t)(sz) <= __LGMALLOC_CONST_GRANULARITY * 64						\
+		? __LGMALLOC_CONST_BLOCKS(sz)										\
+		: ((((size_t)63 - (size_t)__builtin_clzll(__LGMALLOC_CONST_BLOCKS(sz) - 1)) << 2) +	\
+		   (((__LGMALLOC_CONST_BLOCKS(sz) - 1) >>							\
+			 ((size_t)61 - (size_t)__builtin_clzll(__LGMALLOC_CONST_BLOCKS(sz) - 1))) & 0x03) + 41))
+
+#define lgmalloc(sz)														\
+	(__extension__ ({														\
+		__LGMALLOC_TRACK_SITE(sz);											\
+		__builtin_constant_p(sz) && __LGMALLOC_CONST_CLASS(sz)				\
+			? __lgmalloc_class(__LGMALLOC_CONST_CLASS(sz), (sz))			\
+			: __lgmalloc(sz);												\
+	}))
+
 void lgfree(void *ptr);
+/* `size` must be the size the memory was last requested
+ * or reallocated with, not for memory from the aligned
+ * allocation functions */
+void lgfree_sized(void *ptr, size_t size);
 __attribute__((malloc, alloc_size(1, 2)))
 void *lgcalloc(size_t nmemb, size_t size);
 void *lgrealloc(void *ptr, size_t size);
+void *lgreallocarray(void *ptr, size_t nmemb, size_t size);
+
+/* `alignment` must be a power of two, posix_memalign
+ * additionally requires a multiple of sizeof(void*) */
+__attribute__((malloc, alloc_align(1), alloc_size(2)))
+void *lgmemalign(size_t alignment, size_t size);
+__attribute__((malloc, alloc_align(1), alloc_size(2)))
+void *lgaligned_alloc(size_t alignment, size_t size);
+int lgposix_memalign(void **memptr, size_t alignment, size_t size);
+/* Page aligned, pvalloc also rounds up to whole pages */
+__attribute__((malloc, alloc_size(1)))
+void *lgvalloc(size_t size);
+__attribute__((malloc))
+void *lgpvalloc(size_t size);
+
+/* Allocates `count` blocks of `size` bytes into `out`,
+ * returns how many were allocated. Frees `count`
+ * pointers at once, in any order, NULL entries
+ * are skipped. */
+size_t lgmalloc_batch(size_t size, size_t count, void **out);
+void lgfree_batch(void **ptrs, size_t count);
+
+/* Independent heaps owned by the creating thread, which
+ * alone may allocate from and destroy them. Destroying
+ * a heap releases all of its memory at once, anything
+ * still allocated from it included. */
+typedef struct __heap_t lgheap_t;
+
+lgheap_t *lgheap_create(void);
+__attribute__((malloc, alloc_size(2)))
+void *lgheap_malloc(lgheap_t *heap, size_t size);
+void lgheap_free(lgheap_t *heap, void *ptr);
+void lgheap_destroy(lgheap_t *heap);
+
+/* Bump allocator without individual frees, not thread
+ * safe. Resetting keeps the memory for reuse, releasing
+ * also hands its pages back, destroying unmaps it. */
+typedef struct __region_t lgregion_t;
+
+lgregion_t *lgregion_create(void);
+__attribute__((malloc, alloc_size(2)))
+void *lgregion_alloc(lgregion_t *region, size_t size);
+void lgregion_reset(lgregion_t *region);
+void lgregion_release(lgregion_t *region);
+void lgregion_destroy(lgregion_t *region);
+
+/* Real capacity of an allocation, which may exceed what was
+ * requested, and the capacity a request of `size` would get */
+size_t lgmalloc_usable_size(void *ptr);
+size_t lgmalloc_good_size(size_t size);
+
+/* Hands unused memory of the calling thread's heap back
+ * right away, `pad` is accepted for glibc compatibility
+ * and ignored. Returns 1 if anything was released. */
+int lgmalloc_trim(size_t pad);
 
 #ifdef __cplusplus
 }
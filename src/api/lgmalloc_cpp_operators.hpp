@@ -52,20 +52,40 @@ extern void *operator new[](std::size_t size, const std::nothrow_t& tag) noexcep
 
 extern void operator delete(void *ptr, std::size_t size) noexcept
 {
-	static_cast<void>(size);
-	lgfree(ptr);
+	lgfree_sized(ptr, size);
 }
 
 extern void operator delete[](void *ptr, std::size_t size) noexcept
 {
-	static_cast<void>(size);
-	lgfree(ptr);
+	lgfree_sized(ptr, size);
 }
 
 #endif /* __cplusplus >= 201402L */
 
 #if __cplusplus > 201402L || defined(__cpp_aligned_new)
 
+extern void *operator new(std::size_t size, std::align_val_t align) noexcept(false)
+{
+	return lgmemalign(static_cast<std::size_t>(align), size);
+}
+
+extern void *operator new[](std::size_t size, std::align_val_t align) noexcept(false)
+{
+	return lgmemalign(static_cast<std::size_t>(align), size);
+}
+
+extern void *operator new(std::size_t size, std::align_val_t align, const std::nothrow_t& tag) noexcept
+{
+	static_cast<void>(tag);
+	return lgmemalign(static_cast<std::size_t>(align), size);
+}
+
+extern void *operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t& tag) noexcept
+{
+	static_cast<void>(tag);
+	return lgmemalign(static_cast<std::size_t>(align), size);
+}
+
 extern void operator delete(void *ptr, std::align_val_t align) noexcept
 {
 	static_cast<void>(align);
@@ -6,15 +6,107 @@
 /*                                              */
 /* ******************************************** */
 
+/* mremap(2) */
+#define _GNU_SOURCE
+
 #include "internal/lgmalloc_global_include.h"
 #include "internal/lgmalloc_thread_ctx.h"
 #include "internal/lgmalloc_size_classes.h"
+#include "internal/lgmalloc_decommit.h"
+#include "internal/lgmalloc_rseq.h"
 
 #include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <limits.h>
 #include <errno.h>
 
+#if defined(LGMALLOC_ENABLE_NUMA) && defined(__linux__)
+#include <linux/mempolicy.h>
+#endif
+
+#if defined(LGMALLOC_ENABLE_PERCPU) && defined(LGMALLOC_HAVE_RSEQ)
+#define LGMALLOC_PERCPU
+#endif
+
 #define LGMALLOC_TINY_THRESHOLD (LGMALLOC_SMALL_GRANULARITY * 64)
 
+/* Lowest address bits that can hold a user space
+ * mapping, anything above can't be one of ours */
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define LGMALLOC_ADDRESS_BITS		48
+#else
+#define LGMALLOC_ADDRESS_BITS		32
+#endif
+
+#define LGMALLOC_SEGMENT_MAP_SLOTS	\
+	((uintptr_t)1 << (LGMALLOC_ADDRESS_BITS - LGMALLOC_SEGMENT_SIZE_SHIFT))
+
+#define LGMALLOC_SEGMENT_MAP_WORD_BITS	(sizeof(uintptr_t) * CHAR_BIT)
+
+/*
+ * Process wide bitmap with one bit per segment aligned
+ * slot of the address space. It is the only way to tell
+ * whether an arbitrary pointer belongs to a segment before
+ * dereferencing anything derived from it, since masking a
+ * pointer from a dedicated mapping could land on memory
+ * that isn't mapped at all. 128KiB of bss on 64 bit,
+ * only the words covering our segments ever get touched.
+ */
+static _Atomic uintptr_t
+__segment_map_g[LGMALLOC_SEGMENT_MAP_SLOTS / LGMALLOC_SEGMENT_MAP_WORD_BITS];
+
+static ALWAYS_INLINE COLD_CALL
+void segment_map_set(uintptr_t segment, int present)
+{
+	const uintptr_t slot = segment >> LGMALLOC_SEGMENT_SIZE_SHIFT;
+	const uintptr_t bit  = (uintptr_t)1 << (slot % LGMALLOC_SEGMENT_MAP_WORD_BITS);
+
+	_Atomic uintptr_t *word = &__segment_map_g[slot / LGMALLOC_SEGMENT_MAP_WORD_BITS];
+
+	if (present)
+		atomic_fetch_or_explicit(word, bit, memory_order_release);
+	else
+		atomic_fetch_and_explicit(word, ~bit, memory_order_release);
+}
+
+static ALWAYS_INLINE HOT_CALL
+int segment_map_contains(const void *ptr)
+{
+	const uintptr_t slot = (uintptr_t)ptr >> LGMALLOC_SEGMENT_SIZE_SHIFT;
+
+	if (UNLIKELY(slot >= LGMALLOC_SEGMENT_MAP_SLOTS))
+		return 0;
+
+	/* Relaxed is enough, whoever hands us the pointer
+	 * already synchronized with its allocation */
+	const uintptr_t word = atomic_load_explicit(
+		&__segment_map_g[slot / LGMALLOC_SEGMENT_MAP_WORD_BITS],
+		memory_order_relaxed
+	);
+
+	return (int)((word >> (slot % LGMALLOC_SEGMENT_MAP_WORD_BITS)) & 1);
+}
+
+static ALWAYS_INLINE PURE HOT_CALL
+segment_t *segment_of(const void *ptr)
+{
+	return (segment_t*)((uintptr_t)ptr & LGMALLOC_SEGMENT_MASK);
+}
+
+static ALWAYS_INLINE PURE HOT_CALL NO_NULL_ARGS
+chunk_t *chunk_of(const segment_t *segment, const void *ptr)
+{
+	const uintptr_t slice = ((uintptr_t)ptr - segment->mmap_start)
+						  >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT;
+
+	return segment->chunk_map[slice];
+}
+
 static ALWAYS_INLINE COLD_CALL PURE
 size_t align_size_to_page(size_t size)
 {
@@ -25,14 +117,14 @@ size_t align_size_to_page(size_t size)
 /* All mmap calls should go through here
  * Memory will always be committed. */
 static MALLOC_CALL(1) COLD_CALL
-void *memory_map(size_t size)
+void *memory_map_flags(size_t size, int flags)
 {
 	GUARANTEE(size, "size must not be zero");
 
 	void *map = mmap(
 		NULL, size,
 		PROT_READ   | PROT_WRITE,
-		MAP_PRIVATE | MAP_ANONYMOUS,
+		MAP_PRIVATE | MAP_ANONYMOUS | flags,
 		-1, 0
 	);
 
@@ -48,7 +140,149 @@ void *memory_map(size_t size)
 }
 
 static MALLOC_CALL(1) COLD_CALL
-mmap_t *get_dedicated_mmap(size_t size)
+void *memory_map(size_t size)
+{
+	return memory_map_flags(size, 0);
+}
+
+/* Aligned mappings are first asked for at a hint moving
+ * up from here, which the kernel honours whenever that
+ * range is free. Only 64 bit has the room for it. */
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define LGMALLOC_ALIGNED_HINT_BASE	((uintptr_t)4 << 40)
+
+static _Atomic uintptr_t __aligned_hint_g = LGMALLOC_ALIGNED_HINT_BASE;
+#endif
+
+/* Tries the hint first. Otherwise over-maps and trims
+ * both ends, which briefly reserves `alignment` more,
+ * a lot to ask of a hugetlb pool. */
+static MALLOC_CALL(1) COLD_CALL
+void *memory_map_aligned(size_t size, size_t alignment, int flags)
+{
+	GUARANTEE(size, "size must not be zero");
+	GUARANTEE(IS_ALIGNED(alignment, PAGE_SIZE), "alignment must be page aligned");
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+	const uintptr_t hint = atomic_fetch_add_explicit(
+		&__aligned_hint_g, ALIGN_UP(size, alignment), memory_order_relaxed
+	);
+
+	void *hinted = mmap(
+		(void*)ALIGN_UP(hint, alignment), size,
+		PROT_READ   | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | flags,
+		-1, 0
+	);
+
+	if (hinted != MAP_FAILED)
+	{
+		if (IS_ALIGNED((uintptr_t)hinted, alignment))
+			return hinted;
+
+		munmap(hinted, size);
+	}
+#endif
+
+	void *map = memory_map_flags(size + alignment, flags);
+
+	if (UNLIKELY(!map))
+		return NULL;
+
+	const uintptr_t start	= (uintptr_t)map;
+	const uintptr_t aligned	= ALIGN_UP(start, alignment);
+	const uintptr_t tail	= (start + size + alignment) - (aligned + size);
+
+	if (aligned != start)
+		munmap(map, aligned - start);
+
+	if (tail)
+		munmap((void*)(aligned + size), tail);
+
+	return (void*)aligned;
+}
+
+/* NUMA placement.
+ *
+ * Segments and dedicated mappings of a heap prefer the
+ * node of the CPU that created the heap, instead of
+ * wherever first touch happens to land. The policy is
+ * set before anything in the mapping is touched.
+ * 
+ * Only a preference, so an exhausted node still falls
+ * back to others. Machines with a single node, or
+ * kernels without NUMA support, never bind anything. */
+
+#if defined(LGMALLOC_ENABLE_NUMA) && defined(__linux__) && defined(SYS_mbind)
+#define LGMALLOC_NUMA_NODES_MAX	1024
+#define LGMALLOC_NUMA_MASK_WORDS	\
+	(LGMALLOC_NUMA_NODES_MAX / (sizeof(unsigned long) * CHAR_BIT))
+
+static pthread_once_t	__numa_once_g		= PTHREAD_ONCE_INIT;
+static int				__numa_enabled_g	= 0;
+
+static COLD_CALL
+void numa_detect(void)
+{
+	unsigned long mask[LGMALLOC_NUMA_MASK_WORDS] = {0};
+
+	if (syscall(SYS_get_mempolicy, NULL, mask,
+				LGMALLOC_NUMA_NODES_MAX, NULL, MPOL_F_MEMS_ALLOWED))
+		return;
+
+	int nodes = 0;
+
+	for (size_t i = 0; i < LGMALLOC_NUMA_MASK_WORDS; ++i)
+		nodes += __builtin_popcountl(mask[i]);
+
+	__numa_enabled_g = nodes > 1;
+}
+#endif
+
+/* Node of the calling CPU, -1 when placement is off */
+static COLD_CALL
+int numa_current_node(void)
+{
+#if defined(LGMALLOC_ENABLE_NUMA) && defined(__linux__) && defined(SYS_mbind)
+	pthread_once(&__numa_once_g, numa_detect);
+
+	if (!__numa_enabled_g)
+		return -1;
+
+	unsigned int cpu;
+	unsigned int node;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return -1;
+
+	return (int)node;
+#else
+	return -1;
+#endif
+}
+
+static COLD_CALL NO_NULL_ARGS
+void numa_bind(void *alloc, size_t size, int node)
+{
+#if defined(LGMALLOC_ENABLE_NUMA) && defined(__linux__) && defined(SYS_mbind)
+	if (node < 0 || node >= LGMALLOC_NUMA_NODES_MAX)
+		return;
+
+	unsigned long mask[LGMALLOC_NUMA_MASK_WORDS] = {0};
+
+	mask[(size_t)node / (sizeof(unsigned long) * CHAR_BIT)]
+		= 1UL << ((size_t)node % (sizeof(unsigned long) * CHAR_BIT));
+
+	/* Failing leaves the default first touch policy */
+	syscall(SYS_mbind, alloc, size, MPOL_PREFERRED,
+			mask, LGMALLOC_NUMA_NODES_MAX, 0);
+#else
+	DISCARD_ARGS(alloc, size, node);
+#endif
+}
+
+static MALLOC_CALL(1) COLD_CALL
+mmap_t *get_dedicated_mmap(size_t size, int node)
 {
 	GUARANTEE(size, "size must not be zero");
 
@@ -61,51 +295,86 @@ mmap_t *get_dedicated_mmap(size_t size)
 	if (UNLIKELY(!alloc))
 		return NULL;
 
+	numa_bind(alloc, size + LGMALLOC_MMAP_T_SIZE, node);
+
 	mmap_t *map = (mmap_t*)alloc;
 
 	map->alloc	= alloc;
 	map->size	= size;
 	map->next	= NULL;
+	map->prev	= NULL;
+	map->cookie	= LGMALLOC_MMAP_COOKIE(map);
 
 	return map;
 }
 
+/* Aligned mappings place their header past the start
+ * of the mapping, `alloc` is where the mapping begins */
+static ALWAYS_INLINE PURE NO_NULL_ARGS
+size_t dedicated_mmap_length(const mmap_t *map)
+{
+	return (size_t)PTR_DIFF(map, map->alloc) + LGMALLOC_MMAP_T_SIZE + map->size;
+}
+
 static COLD_CALL NO_NULL_ARGS
-void store_dedicated_mmap(
-	heap_t *RESTRICT heap,
-	mmap_t          *map)
+void unmap_dedicated_mmap(mmap_t *map)
 {
-	/* Avoid prefetching since the function is a cold call,
-	 * the datastructures are decently small and will likely
-	 * fit within 1 or 2 cache lines, there will likely also
-	 * be very few dedicated memory maps, so the traversal
-	 * will be very short and the memory will already be
-	 * hot since the heap and map are constantly being
-	 * used in the call graph. So prefetching here would
-	 * almost double the instruction cycles. */
+	munmap(map->alloc, dedicated_mmap_length(map));
+}
 
-	if (UNLIKELY(!heap->mmap_list))
+/* Unmaps a list of mappings chained through `next`,
+ * which is what the mmap cache hands back on eviction */
+static COLD_CALL
+void unmap_dedicated_mmaps(mmap_t *map)
+{
+	while (map)
 	{
-		heap->mmap_list  = map;
-		heap->mmap_count = 1;
-		return;
+		mmap_t *next = map->next;
+		unmap_dedicated_mmap(map);
+		map = next;
 	}
+}
+
+static COLD_CALL NO_NULL_ARGS
+void store_dedicated_mmap(
+	heap_t *RESTRICT heap,
+	mmap_t          *map)
+{
+	map->parent_heap	= heap;
+	map->prev			= NULL;
+	map->next			= heap->mmap_list;
 
-	mmap_t *cur = heap->mmap_list;
-	for(; cur->next; cur = cur->next);
+	if (heap->mmap_list)
+		heap->mmap_list->prev = map;
 
-	cur->next = map;
+	heap->mmap_list = map;
 	++heap->mmap_count;
 }
 
+static COLD_CALL NO_NULL_ARGS
+void remove_dedicated_mmap(
+	heap_t *RESTRICT heap,
+	mmap_t          *map)
+{
+	if (map->prev)
+		map->prev->next = map->next;
+	else
+		heap->mmap_list = map->next;
+
+	if (map->next)
+		map->next->prev = map->prev;
+
+	--heap->mmap_count;
+}
+
 /*
  * Allocate the first sizeof(heap_t) bytes onto the
  * memory mapping for the thread's heap structure.
  * Because each thread has its own heap, we can use
  * the thread id to uniquely identify each heap. 
  * 
- * This function should be only be used by thread_ctx
- * to initialize the current thread context heap.
+ * This function should be only be used by heap_create
+ * which places the heap in its first segment.
  */
 static COLD_CALL FLATTEN inline NO_NULL_ARGS
 heap_t *heap_init(void *alloc, size_t size)
@@ -116,89 +385,2589 @@ heap_t *heap_init(void *alloc, size_t size)
 	heap_t *heap = (heap_t*)alloc;
 	memset_constexpr(heap, 0, sizeof(heap_t));
 
-	heap->tid = lgmalloc_get_tid();
+	atomic_init(&heap->tid, lgmalloc_get_tid());
+	atomic_flag_clear(&heap->purge_lock);
 
 	return heap;
 }
 
-static MALLOC_CALL(2) ALWAYS_INLINE NO_NULL_ARGS
-void *do_tiny_alloc(heap_t *RESTRICT heap, size_t size)
+static COLD_CALL NO_NULL_ARGS
+segment_t *segment_init(void *alloc)
 {
-	GUARANTEE(size, "size must not be 0");
+	/* Fresh anonymous mappings are already zeroed,
+	 * only the non-zero fields need to be written */
+	segment_t *segment = (segment_t*)alloc;
 
-	ASSUME(size <= LGMALLOC_TINY_THRESHOLD);
+	segment->segment_size	= LGMALLOC_SEGMENT_SIZE;
+	segment->mmap_start		= (uintptr_t)alloc;
+	segment->chunk_top		= LGMALLOC_SEGMENT_META_SIZE;
 
-	const size_t class = (((size_t)size + (LGMALLOC_SMALL_GRANULARITY - 1))
-										/  LGMALLOC_SMALL_GRANULARITY);
+	return segment;
+}
+
+/* Segments are aligned to their own size, which is a
+ * multiple of the huge page size, so every huge page in
+ * one is fully backed. Explicit huge pages come from a
+ * reserved pool that is usually empty, in which case we
+ * fall back to transparent ones. */
+static COLD_CALL
+void *segment_map(void)
+{
+#if defined(LGMALLOC_ENABLE_HUGEPAGES)
+	void *alloc = NULL;
+
+#if defined(MAP_HUGETLB)
+	alloc = memory_map_aligned(
+		LGMALLOC_SEGMENT_SIZE,
+		LGMALLOC_SEGMENT_SIZE,
+		MAP_HUGETLB
+	);
 
-	block_t *block = ...;
+	if (alloc)
+		return alloc;
+#endif
 
-	if (UNLIKELY(!block))
+	alloc = memory_map_aligned(
+		LGMALLOC_SEGMENT_SIZE,
+		LGMALLOC_SEGMENT_SIZE,
+		0
+	);
+
+#if defined(MADV_HUGEPAGE)
+	if (LIKELY(alloc))
+		madvise(alloc, LGMALLOC_SEGMENT_SIZE, MADV_HUGEPAGE);
+#endif
+
+	return alloc;
+#else
+	return memory_map_aligned(
+		LGMALLOC_SEGMENT_SIZE,
+		LGMALLOC_SEGMENT_SIZE,
+		0
+	);
+#endif /* LGMALLOC_ENABLE_HUGEPAGES */
+}
+
+static COLD_CALL
+segment_t *segment_alloc(int node)
+{
+	void *alloc = segment_map();
+
+	if (UNLIKELY(!alloc))
 		return NULL;
 
-	return block;
+	numa_bind(alloc, LGMALLOC_SEGMENT_SIZE, node);
+
+	segment_map_set((uintptr_t)alloc, 1);
+
+	return segment_init(alloc);
 }
 
-static NO_INLINE MALLOC_CALL(2) NO_NULL_ARGS
-void *heap_alloc_mmap(heap_t *heap, size_t size)
+static COLD_CALL NO_NULL_ARGS
+void heap_attach_segment(
+	heap_t *RESTRICT	heap,
+	segment_t *RESTRICT	segment)
 {
-	GUARANTEE(size, "size must not be 0");
+	atomic_store_explicit(&segment->parent_heap, heap, memory_order_release);
+
+	segment->next			= heap->segment_list;
+	heap->segment_list		= segment;
+	++heap->segment_count;
+}
 
-	mmap_t *map = get_dedicated_mmap(size);
+/* Every heap, so the background purge thread can visit them.
+ * Only touched when heaps are created or unmapped and by
+ * the background thread itself. */
 
-	if (UNLIKELY(!map))
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE)
+static pthread_mutex_t	__heaps_lock_g	= PTHREAD_MUTEX_INITIALIZER;
+static heap_t			*__heaps_g		= NULL;
+#endif
+
+static COLD_CALL NO_NULL_ARGS
+void heap_register(heap_t *heap)
+{
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE)
+	pthread_mutex_lock(&__heaps_lock_g);
+
+	heap->next_registered	= __heaps_g;
+	__heaps_g				= heap;
+
+	pthread_mutex_unlock(&__heaps_lock_g);
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heap_unregister(heap_t *heap)
+{
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE)
+	pthread_mutex_lock(&__heaps_lock_g);
+
+	heap_t **link = &__heaps_g;
+
+	for (; *link && *link != heap; link = &(*link)->next_registered);
+
+	if (*link)
+		*link = heap->next_registered;
+
+	pthread_mutex_unlock(&__heaps_lock_g);
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+/* Maps the heap's first segment and places the heap
+ * structure right after the segment structure in it.
+ * 
+ * Threads should go through `heap_acquire` instead,
+ * which reuses abandoned heaps before mapping more. */
+COLD_CALL NO_INLINE
+heap_t *heap_create(void)
+{
+	const int node		= numa_current_node();
+	segment_t *segment	= segment_alloc(node);
+
+	if (UNLIKELY(!segment))
 		return NULL;
 
-	store_dedicated_mmap(heap, map);
+	heap_t *heap = heap_init(
+		OFFSET_PTR(segment, LGMALLOC_SEGMENT_T_SIZE),
+		LGMALLOC_SEGMENT_META_SIZE - LGMALLOC_SEGMENT_T_SIZE
+	);
 
-	return OFFSET_PTR(map->alloc, LGMALLOC_MMAP_T_SIZE);
+	GUARANTEE(heap, "segment metadata must fit the heap");
+
+	heap->numa_node = node;
+
+	heap_attach_segment(heap, segment);
+	heap_register(heap);
+
+	return heap;
 }
 
-MALLOC_CALL(2) ALWAYS_INLINE NO_NULL_ARGS
-void *regular_heap_alloc(heap_t *heap, size_t size)
+/* Bins only ever hold chunks with at least one free
+ * block, so the allocation fast path never has to
+ * look past the head of the bin. */
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_bin_push(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
 {
-	GUARANTEE(size, "size must not be 0");
-	ASSUME(size > LGMALLOC_TINY_THRESHOLD);
+	chunk_t **bin = &heap->chunk_bins[chunk->size_class];
 
-	size_t class = get_size_class(size);
+	chunk->prev = NULL;
+	chunk->next = *bin;
 
-	if (UNLIKELY(!class))
+	if (*bin)
+		(*bin)->prev = chunk;
+
+	*bin = chunk;
+}
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_bin_remove(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
+{
+	if (chunk->prev)
+		chunk->prev->next = chunk->next;
+	else
+		heap->chunk_bins[chunk->size_class] = chunk->next;
+
+	if (chunk->next)
+		chunk->next->prev = chunk->prev;
+
+	chunk->next = NULL;
+	chunk->prev = NULL;
+}
+
+/* Offset of the first block from the chunk. Blocks start
+ * at the block size's natural alignment, up to a page, so
+ * every block of a class is aligned to the largest power
+ * of two dividing its size. Chunks themselves are small
+ * chunk aligned, which covers any offset up to a page. */
+static ALWAYS_INLINE CONST_CALL
+size_t chunk_blocks_offset(size_t block_size)
+{
+	const size_t natural = block_size & -block_size;
+
+	if (natural <= LGMALLOC_CHUNK_HEADER_SIZE)
+		return LGMALLOC_CHUNK_HEADER_SIZE;
+
+	return natural < PAGE_SIZE ? natural : PAGE_SIZE;
+}
+
+/* Chunks span a whole number of small chunk slices,
+ * enough to hold the header and the class's blocks */
+COLD_CALL
+size_t heap_chunk_span(size_t class)
+{
+	const size_class_t *sc = get_size_classes() + class;
+
+	return ALIGN_UP(
+		chunk_blocks_offset(sc->block_sz) + sc->block_sz * sc->block_cnt,
+		LGMALLOC_SMALL_CHUNK_SIZE
+	);
+}
+
+/* Carves the next chunk for `class` off the segment */
+static COLD_CALL NO_NULL_ARGS
+chunk_t *segment_carve_chunk(segment_t *segment, size_t class)
+{
+	const size_class_t *sc = get_size_classes() + class;
+
+	const size_t offset	= chunk_blocks_offset(sc->block_sz);
+	const size_t span	= heap_chunk_span(class);
+
+	if (UNLIKELY(segment->chunk_top + span > segment->segment_size))
 		return NULL;
 
-	if (LIKELY(class < get_size_class_count()))
-	{
-		block_t *block = ...;
+	chunk_t *chunk = (chunk_t*)(segment->mmap_start + segment->chunk_top);
 
-		if (UNLIKELY(!block))
-		{
-			/* Fallback to allocating back on chunk */
-			/* Needs to be handled efficiently */
-		}
+	const size_t first = segment->chunk_top >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT;
+	const size_t last  = first + (span >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT);
 
-		return block;
-	}
+	for (size_t slice = first; slice < last; ++slice)
+		segment->chunk_map[slice] = chunk;
 
-	return heap_alloc_mmap(heap, size);
+	segment->chunk_top += span;
+	++segment->chunk_count;
+
+	chunk->size_class		= class;
+	chunk->block_size		= sc->block_sz;
+	chunk->block_count		= sc->block_cnt;
+	chunk->parent_segment	= segment;
+	chunk->frontier			= (uintptr_t)OFFSET_PTR(chunk, offset);
+
+	return chunk;
 }
 
-MALLOC_CALL(2) HOT_CALL NO_INLINE NO_NULL_ARGS
-void *heap_alloc(heap_t *heap, size_t size)
+/* Carving on behalf of `heap`, which the profile counts */
+static ALWAYS_INLINE COLD_CALL NO_NULL_ARGS
+chunk_t *heap_carve_chunk(heap_t *RESTRICT heap, segment_t *RESTRICT segment, size_t class)
 {
-	GUARANTEE(size, "size must not be 0");
+	chunk_t *chunk = segment_carve_chunk(segment, class);
 
-	if (size <= LGMALLOC_TINY_THRESHOLD)
-	{
-		block_t *block = do_tiny_alloc(heap, size);
+#if defined(LGMALLOC_ENABLE_PROFILING)
+	if (LIKELY(chunk))
+		prof_record_chunks(class, chunk->block_size, ++heap->chunks_carved[class]);
+#else
+	DISCARD_ARGS(heap);
+#endif
 
-		if (LIKELY(block))
-			return block;
-	}
+	return chunk;
+}
 
-	void *alloc = regular_heap_alloc(heap, size);
+/* Coarse monotonic milliseconds, only used for decay.
+ * The coarse clock is a plain vDSO read on Linux. */
+static COLD_CALL
+uint64_t heap_clock_ms(void)
+{
+	struct timespec ts;
 
-	if (UNLIKELY(!alloc))
-		errno = errno != EAGAIN
-			  ? ENOMEM : EAGAIN;
+#if defined(CLOCK_MONOTONIC_COARSE)
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
 
-	return alloc;
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* The shared per-CPU heap is refilled and drained under
+ * the lock of a single class, see the per-CPU bins below.
+ * What its classes have in common, the segments chunks are
+ * carved from and the dedicated mappings, additionally
+ * takes this lock. It's never held across a syscall.
+ * 
+ * Every other heap has a single owner and skips it. */
+
+#if defined(LGMALLOC_PERCPU)
+static pthread_mutex_t	__percpu_heap_lock_g	= PTHREAD_MUTEX_INITIALIZER;
+static heap_t			*__percpu_heap_g		= NULL;
+#endif
+
+static ALWAYS_INLINE PURE NO_NULL_ARGS
+int heap_is_shared(const heap_t *heap)
+{
+#if defined(LGMALLOC_PERCPU)
+	return heap == __percpu_heap_g;
+#else
+	DISCARD_ARGS(heap);
+	return 0;
+#endif
+}
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_shared_lock(heap_t *heap)
+{
+#if defined(LGMALLOC_PERCPU)
+	if (heap_is_shared(heap))
+		pthread_mutex_lock(&__percpu_heap_lock_g);
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_shared_unlock(heap_t *heap)
+{
+#if defined(LGMALLOC_PERCPU)
+	if (heap_is_shared(heap))
+		pthread_mutex_unlock(&__percpu_heap_lock_g);
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+/* Decayed purging.
+ *
+ * A chunk whose last block was freed leaves its bin for
+ * the heap's purge queue, stamped with the time it
+ * emptied, oldest first. Only once it stayed empty for
+ * LGMALLOC_PURGE_DECAY_MS are its pages handed back, so
+ * freeing and reallocating the same memory in quick
+ * succession never faults. The slow path takes queued
+ * chunks back before carving new ones.
+ * 
+ * The head of its bin is never queued, it's the next
+ * chunk allocated from anyway. So at most one empty
+ * chunk per class stays resident indefinitely.
+ * 
+ * A purged chunk keeps its header page and forgets its
+ * blocks, the free list lived in the purged pages.
+ * 
+ * Queued chunks are in no bin, so the allocation fast
+ * path never sees them. That's what lets the background
+ * purge thread work on the queue under `purge_lock`
+ * alone, every other access happens on a slow path.
+ * The shared per-CPU heap takes it too, its classes
+ * are refilled concurrently but share one queue.
+ * 
+ * Segments backed by huge pages skip all of this, empty
+ * chunks simply stay in their bin. A chunk is far smaller
+ * than a huge page and its header, which must survive,
+ * shares the huge page with its blocks. Purging part of
+ * one would split it, and hugetlb mappings don't take
+ * MADV_FREE at all. */
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_purge_lock(heap_t *heap)
+{
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE) || defined(LGMALLOC_PERCPU)
+	while (atomic_flag_test_and_set_explicit(&heap->purge_lock, memory_order_acquire))
+		sched_yield();
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_purge_unlock(heap_t *heap)
+{
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE) || defined(LGMALLOC_PERCPU)
+	atomic_flag_clear_explicit(&heap->purge_lock, memory_order_release);
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+static COLD_CALL NO_NULL_ARGS
+void chunk_purge(chunk_t *chunk, int eager)
+{
+	void *blocks		= OFFSET_PTR(chunk, chunk_blocks_offset(chunk->block_size));
+	const size_t used	= chunk->frontier - (uintptr_t)blocks;
+
+	if (used)
+		vm_purge_aligned(blocks, used, eager);
+
+	chunk->free_list	= NULL;
+	chunk->frontier		= (uintptr_t)blocks;
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heap_purge_dequeue(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
+{
+	if (chunk->purge_prev)
+		chunk->purge_prev->purge_next = chunk->purge_next;
+	else
+		heap->purge_head = chunk->purge_next;
+
+	if (chunk->purge_next)
+		chunk->purge_next->purge_prev = chunk->purge_prev;
+	else
+		heap->purge_tail = chunk->purge_prev;
+
+	chunk->purge_next	= NULL;
+	chunk->purge_prev	= NULL;
+	chunk->is_queued	= 0;
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heap_purge_append(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
+{
+	chunk->purge_next	= NULL;
+	chunk->purge_prev	= heap->purge_tail;
+	chunk->is_queued	= 1;
+
+	if (heap->purge_tail)
+		heap->purge_tail->purge_next = chunk;
+	else
+		heap->purge_head = chunk;
+
+	heap->purge_tail = chunk;
+}
+
+/* Purged chunks are grouped by class, any of them
+ * costs the same page faults to use again */
+static COLD_CALL NO_NULL_ARGS
+void heap_purged_push(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
+{
+	chunk_t **bin = &heap->purged_bins[chunk->size_class];
+
+	chunk->purge_prev	= NULL;
+	chunk->purge_next	= *bin;
+	chunk->is_purged	= 1;
+
+	if (*bin)
+		(*bin)->purge_prev = chunk;
+
+	*bin = chunk;
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heap_purged_remove(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
+{
+	if (chunk->purge_prev)
+		chunk->purge_prev->purge_next = chunk->purge_next;
+	else
+		heap->purged_bins[chunk->size_class] = chunk->purge_next;
+
+	if (chunk->purge_next)
+		chunk->purge_next->purge_prev = chunk->purge_prev;
+
+	chunk->purge_next	= NULL;
+	chunk->purge_prev	= NULL;
+	chunk->is_purged	= 0;
+}
+
+/* Purges every chunk that emptied before the decay period,
+ * passing UINT64_MAX as `now` purges the whole queue.
+ * Must be called with `purge_lock` held. */
+static COLD_CALL NO_NULL_ARGS
+void heap_purge_decay(heap_t *heap, uint64_t now, int eager)
+{
+	chunk_t *chunk;
+
+	while ((chunk = heap->purge_head) &&
+		   now - chunk->empty_since >= LGMALLOC_PURGE_DECAY_MS)
+	{
+		heap_purge_dequeue(heap, chunk);
+		chunk_purge(chunk, eager);
+		heap_purged_push(heap, chunk);
+	}
+}
+
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+void heap_purge_enqueue(heap_t *RESTRICT heap, chunk_t *RESTRICT chunk)
+{
+#if defined(LGMALLOC_ENABLE_HUGEPAGES)
+	DISCARD_ARGS(heap, chunk);
+#else
+	if (heap->chunk_bins[chunk->size_class] == chunk)
+		return;
+
+	heap_bin_remove(heap, chunk);
+
+	const uint64_t now = heap_clock_ms();
+
+	chunk->empty_since = now;
+
+	heap_purge_lock(heap);
+	heap_purge_append(heap, chunk);
+	heap_purge_decay(heap, now, 0);
+	heap_purge_unlock(heap);
+#endif
+}
+
+/* Most recently emptied chunk of `class`, the one
+ * most likely to still have its pages resident,
+ * otherwise one that was already purged. Decays the
+ * queue first while at it. Both lists are only ever
+ * looked at under `purge_lock`, the background purge
+ * thread and other classes of the shared heap write
+ * them concurrently. */
+static COLD_CALL NO_NULL_ARGS
+chunk_t *heap_purge_take(heap_t *heap, size_t class)
+{
+	heap_purge_lock(heap);
+
+	if (heap->purge_head)
+		heap_purge_decay(heap, heap_clock_ms(), 0);
+
+	chunk_t *chunk = heap->purge_tail;
+
+	for (; chunk && chunk->size_class != class; chunk = chunk->purge_prev);
+
+	if (chunk)
+		heap_purge_dequeue(heap, chunk);
+	else if ((chunk = heap->purged_bins[class]))
+		heap_purged_remove(heap, chunk);
+
+	heap_purge_unlock(heap);
+
+	return chunk;
+}
+
+/* Background purging.
+ *
+ * Threads that went idle never reach their own slow
+ * path, so their queues would never decay. The thread
+ * wakes up every LGMALLOC_BACKGROUND_PURGE_INTERVAL_MS
+ * and purges what decayed on every registered heap.
+ * It decommits eagerly, the point is to lower the
+ * resident set of idle processes right away.
+ * 
+ * It's started from a slow path rather than from heap
+ * creation, creating a thread allocates and the heap
+ * has to be usable by then. It never allocates itself.
+ * 
+ * Segments themselves stay mapped. Once all of their
+ * chunks are purged only the header pages are left
+ * resident, and unmapping one would mean unlinking it
+ * from a segment list its owner walks without a lock. */
+
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE)
+static atomic_int __background_purge_started_g = 0;
+
+static COLD_CALL
+void *background_purge_main(void *arg)
+{
+	DISCARD_ARGS(arg);
+
+	const struct timespec interval = {
+		.tv_sec		= LGMALLOC_BACKGROUND_PURGE_INTERVAL_MS / 1000,
+		.tv_nsec	= (LGMALLOC_BACKGROUND_PURGE_INTERVAL_MS % 1000) * 1000000L
+	};
+
+	for (;;)
+	{
+		nanosleep(&interval, NULL);
+
+		pthread_mutex_lock(&__heaps_lock_g);
+
+		for (heap_t *heap = __heaps_g; heap; heap = heap->next_registered)
+		{
+			heap_purge_lock(heap);
+			heap_purge_decay(heap, heap_clock_ms(), 1);
+			heap_purge_unlock(heap);
+		}
+
+		pthread_mutex_unlock(&__heaps_lock_g);
+	}
+
+	return NULL;
+}
+#endif /* LGMALLOC_ENABLE_BACKGROUND_PURGE */
+
+static ALWAYS_INLINE COLD_CALL
+void background_purge_start(void)
+{
+#if defined(LGMALLOC_ENABLE_BACKGROUND_PURGE)
+	if (LIKELY(atomic_load_explicit(&__background_purge_started_g, memory_order_relaxed)))
+		return;
+
+	if (atomic_exchange_explicit(&__background_purge_started_g, 1, memory_order_relaxed))
+		return;
+
+	pthread_t		thread;
+	pthread_attr_t	attr;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&thread, &attr, background_purge_main, NULL);
+	pthread_attr_destroy(&attr);
+#endif /* LGMALLOC_ENABLE_BACKGROUND_PURGE */
+}
+
+static ALWAYS_INLINE PURE HOT_CALL
+mmap_t *mmap_of(const void *ptr)
+{
+	return (mmap_t*)OFFSET_PTR(ptr, -(ptrdiff_t)LGMALLOC_MMAP_T_SIZE);
+}
+
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+void heap_drain_thread_free(heap_t *heap);
+
+static COLD_CALL NO_NULL_ARGS
+segment_t *heap_reclaim_segment(heap_t *heap);
+
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+chunk_t *heap_refill_bin(heap_t *heap, size_t class)
+{
+	background_purge_start();
+
+	/* Blocks other threads handed back might
+	 * make a brand new chunk unnecessary */
+	if (atomic_load_explicit(&heap->thread_free, memory_order_relaxed))
+	{
+		heap_drain_thread_free(heap);
+
+		if (heap->chunk_bins[class])
+			return heap->chunk_bins[class];
+	}
+
+	chunk_t *chunk = heap_purge_take(heap, class);
+
+	segment_t *segment;
+
+	if (!chunk)
+	{
+		heap_shared_lock(heap);
+
+		if ((segment = heap->segment_list))
+			chunk = heap_carve_chunk(heap, segment, class);
+
+		heap_shared_unlock(heap);
+	}
+
+	/* Prefer segments abandoned heaps left behind,
+	 * they might even bring chunks of this class.
+	 * Their chunks land in any class's bin though,
+	 * which the shared heap can't have, and with
+	 * per-CPU bins no heap gets abandoned anyway. */
+	if (UNLIKELY(!chunk) && !heap_is_shared(heap) &&
+		(segment = heap_reclaim_segment(heap)))
+	{
+		if (heap->chunk_bins[class])
+			return heap->chunk_bins[class];
+
+		chunk = heap_carve_chunk(heap, segment, class);
+	}
+
+	if (UNLIKELY(!chunk))
+	{
+		segment = segment_alloc(heap->numa_node);
+
+		if (UNLIKELY(!segment))
+			return NULL;
+
+		heap_shared_lock(heap);
+
+		heap_attach_segment(heap, segment);
+		chunk = heap_carve_chunk(heap, segment, class);
+
+		heap_shared_unlock(heap);
+
+		if (UNLIKELY(!chunk))
+			return NULL;
+	}
+
+	heap_bin_push(heap, chunk);
+
+	return chunk;
+}
+
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+void *heap_bin_pop(heap_t *heap, size_t class)
+{
+	chunk_t *chunk = heap->chunk_bins[class];
+
+	if (UNLIKELY(!chunk))
+	{
+		chunk = heap_refill_bin(heap, class);
+
+		if (UNLIKELY(!chunk))
+			return NULL;
+	}
+
+	/* A chunk with blocks left either has a freed block
+	 * or uncarved room past the frontier, so the frontier
+	 * never needs a bounds check of its own. */
+	block_t *block = chunk->free_list;
+
+	if (LIKELY(block))
+		chunk->free_list = block->next;
+	else
+	{
+		block = (block_t*)chunk->frontier;
+		chunk->frontier += chunk->block_size;
+	}
+
+	if (UNLIKELY(++chunk->blocks_in_use == chunk->block_count))
+	{
+		chunk->is_full = 1;
+		heap_bin_remove(heap, chunk);
+	}
+
+	return block;
+}
+
+/* Carves up front what the persisted profile says a
+ * heap needed of each class, see profiling.c. Only
+ * the chunk headers are written, blocks still fault
+ * in as they're handed out. Whatever doesn't fit the
+ * first segment is left to the slow path as usual. */
+static COLD_CALL NO_NULL_ARGS
+void heap_warm_start(heap_t *heap)
+{
+#if defined(LGMALLOC_ENABLE_PROFILING)
+	segment_t *segment		= heap->segment_list;
+	const size_class_t *sc	= get_size_classes();
+	const size_t count		= get_size_class_count();
+
+	int full = 0;
+
+	for (size_t class = 1; class < count && !full; ++class)
+	{
+		size_t chunks = prof_warm_chunks(sc[class].block_sz);
+
+		for (; chunks && !full; --chunks)
+		{
+			chunk_t *chunk = heap_carve_chunk(heap, segment, class);
+
+			if (UNLIKELY(!chunk))
+				full = 1;
+			else
+				heap_bin_push(heap, chunk);
+		}
+	}
+#else
+	DISCARD_ARGS(heap);
+#endif
+}
+
+static MALLOC_CALL(2) ALWAYS_INLINE NO_NULL_ARGS
+void *do_tiny_alloc(heap_t *RESTRICT heap, size_t size)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	ASSUME(size <= LGMALLOC_TINY_THRESHOLD);
+
+	const size_t class = (((size_t)size + (LGMALLOC_SMALL_GRANULARITY - 1))
+										/  LGMALLOC_SMALL_GRANULARITY);
+
+	return heap_bin_pop(heap, class);
+}
+
+/* Dedicated mapping cache.
+ *
+ * Bin `n` holds mappings of [2^n, 2^(n+1)) times the
+ * threshold, so anything taken from the request's bin
+ * wastes less than half of it. Mappings too large for
+ * the last bin or for the byte budget aren't cached. */
+
+static ALWAYS_INLINE CONST_CALL
+size_t mmap_cache_bin(size_t size)
+{
+	const size_t units = size / ALIGN_UP(LGMALLOC_MMAP_THRESHOLD, PAGE_SIZE);
+
+	if (!units)
+		return 0;
+
+	return (size_t)(sizeof(long) * CHAR_BIT - 1) - (size_t)__builtin_clzl(units);
+}
+
+/* Evicted mappings are chained onto `victims` rather than
+ * unmapped, so the caller can unmap them after unlocking */
+static COLD_CALL NO_NULL_ARGS
+void heap_mmap_cache_evict(heap_t *heap, mmap_cache_entry_t *entry, mmap_t **victims)
+{
+	heap->mmap_cache_bytes -= entry->map->size;
+	--heap->mmap_cache_count;
+
+	entry->map->next	= *victims;
+	*victims			= entry->map;
+	entry->map			= NULL;
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heap_mmap_cache_decay(heap_t *heap, uint64_t now, mmap_t **victims)
+{
+	for (size_t bin = 0; bin < LGMALLOC_MMAP_CACHE_BINS; ++bin)
+		for (size_t slot = 0; slot < LGMALLOC_MMAP_CACHE_SLOTS; ++slot)
+		{
+			mmap_cache_entry_t *entry = &heap->mmap_cache[bin][slot];
+
+			if (entry->map && now - entry->stamp >= LGMALLOC_MMAP_CACHE_DECAY_MS)
+				heap_mmap_cache_evict(heap, entry, victims);
+		}
+}
+
+/* Oldest entry within `bin`, or within every bin
+ * when `bin` is LGMALLOC_MMAP_CACHE_BINS */
+static COLD_CALL NO_NULL_ARGS
+mmap_cache_entry_t *heap_mmap_cache_oldest(heap_t *heap, size_t bin)
+{
+	const size_t first	= bin < LGMALLOC_MMAP_CACHE_BINS ? bin : 0;
+	const size_t last	= bin < LGMALLOC_MMAP_CACHE_BINS ? bin + 1 : bin;
+
+	mmap_cache_entry_t *oldest = NULL;
+
+	for (size_t i = first; i < last; ++i)
+		for (size_t slot = 0; slot < LGMALLOC_MMAP_CACHE_SLOTS; ++slot)
+		{
+			mmap_cache_entry_t *entry = &heap->mmap_cache[i][slot];
+
+			if (entry->map && (!oldest || entry->stamp < oldest->stamp))
+				oldest = entry;
+		}
+
+	return oldest;
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heap_mmap_cache_flush(heap_t *heap, mmap_t **victims)
+{
+	heap_mmap_cache_decay(heap, UINT64_MAX, victims);
+}
+
+/* Returns 0 if the mapping wasn't cached and still
+ * has to be unmapped by the caller */
+static COLD_CALL NO_NULL_ARGS
+int heap_mmap_cache_put(heap_t *RESTRICT heap, mmap_t *RESTRICT map, mmap_t **victims)
+{
+	const size_t bin = mmap_cache_bin(map->size);
+
+	if (map->size > LGMALLOC_MMAP_CACHE_MAX_BYTES || bin >= LGMALLOC_MMAP_CACHE_BINS)
+		return 0;
+
+	const uint64_t now = heap_clock_ms();
+
+	heap_mmap_cache_decay(heap, now, victims);
+
+	while (heap->mmap_cache_bytes + map->size > LGMALLOC_MMAP_CACHE_MAX_BYTES)
+		heap_mmap_cache_evict(
+			heap, heap_mmap_cache_oldest(heap, LGMALLOC_MMAP_CACHE_BINS), victims
+		);
+
+	mmap_cache_entry_t *entry = NULL;
+
+	for (size_t slot = 0; slot < LGMALLOC_MMAP_CACHE_SLOTS && !entry; ++slot)
+		if (!heap->mmap_cache[bin][slot].map)
+			entry = &heap->mmap_cache[bin][slot];
+
+	if (!entry)
+	{
+		entry = heap_mmap_cache_oldest(heap, bin);
+		heap_mmap_cache_evict(heap, entry, victims);
+	}
+
+	entry->map		= map;
+	entry->stamp	= now;
+
+	heap->mmap_cache_bytes += map->size;
+	++heap->mmap_cache_count;
+
+	return 1;
+}
+
+/* Best fit within the request's bin */
+static COLD_CALL NO_NULL_ARGS
+mmap_t *heap_mmap_cache_take(heap_t *heap, size_t size, mmap_t **victims)
+{
+	const size_t bin = mmap_cache_bin(size);
+
+	if (bin >= LGMALLOC_MMAP_CACHE_BINS)
+		return NULL;
+
+	heap_mmap_cache_decay(heap, heap_clock_ms(), victims);
+
+	mmap_cache_entry_t *best = NULL;
+
+	for (size_t slot = 0; slot < LGMALLOC_MMAP_CACHE_SLOTS; ++slot)
+	{
+		mmap_cache_entry_t *entry = &heap->mmap_cache[bin][slot];
+
+		if (entry->map && entry->map->size >= size &&
+			(!best || entry->map->size < best->map->size))
+			best = entry;
+	}
+
+	if (!best)
+		return NULL;
+
+	mmap_t *map = best->map;
+
+	heap->mmap_cache_bytes -= map->size;
+	--heap->mmap_cache_count;
+	best->map = NULL;
+
+	return map;
+}
+
+static NO_INLINE MALLOC_CALL(2) NO_NULL_ARGS
+void *heap_alloc_mmap(heap_t *heap, size_t size)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	mmap_t *victims = NULL;
+
+	heap_shared_lock(heap);
+
+	mmap_t *map = heap->mmap_cache_count
+				? heap_mmap_cache_take(heap, align_size_to_page(size), &victims)
+				: NULL;
+
+	heap_shared_unlock(heap);
+
+	unmap_dedicated_mmaps(victims);
+
+	if (!map)
+		map = get_dedicated_mmap(size, heap->numa_node);
+
+	if (UNLIKELY(!map))
+		return NULL;
+
+	heap_shared_lock(heap);
+	store_dedicated_mmap(heap, map);
+	heap_shared_unlock(heap);
+
+	return OFFSET_PTR(map, LGMALLOC_MMAP_T_SIZE);
+}
+
+/* Over-maps by the alignment and trims both ends, so only
+ * the pages holding the header and the payload remain.
+ * The mapping is rounded to whole pages, alignments below
+ * a page leave the payload ending mid page otherwise and
+ * the last page would reach past the end of the mapping. */
+static NO_INLINE MALLOC_CALL(2) NO_NULL_ARGS
+void *heap_alloc_mmap_aligned(heap_t *heap, size_t size, size_t alignment)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	size = align_size_to_page(size);
+
+	const size_t length = ALIGN_UP(LGMALLOC_MMAP_T_SIZE + size + alignment, PAGE_SIZE);
+
+	void *alloc = memory_map(length);
+
+	if (UNLIKELY(!alloc))
+		return NULL;
+
+	const uintptr_t start	= (uintptr_t)alloc;
+	const uintptr_t end		= start + length;
+	const uintptr_t user	= ALIGN_UP(start + LGMALLOC_MMAP_T_SIZE, alignment);
+	const uintptr_t head	= ALIGN_DOWN(user - LGMALLOC_MMAP_T_SIZE, PAGE_SIZE);
+	const uintptr_t tail	= ALIGN_UP(user + size, PAGE_SIZE);
+
+	if (head != start)
+		munmap(alloc, head - start);
+
+	if (tail != end)
+		munmap((void*)tail, end - tail);
+
+	numa_bind((void*)head, tail - head, heap->numa_node);
+
+	mmap_t *map = (mmap_t*)(user - LGMALLOC_MMAP_T_SIZE);
+
+	map->alloc	= (void*)head;
+	map->size	= size;
+	map->next	= NULL;
+	map->prev	= NULL;
+	map->cookie	= LGMALLOC_MMAP_COOKIE(map);
+
+	heap_shared_lock(heap);
+	store_dedicated_mmap(heap, map);
+	heap_shared_unlock(heap);
+
+	return (void*)user;
+}
+
+MALLOC_CALL(2) ALWAYS_INLINE NO_NULL_ARGS
+void *regular_heap_alloc(heap_t *heap, size_t size)
+{
+	GUARANTEE(size, "size must not be 0");
+	ASSUME(size > LGMALLOC_TINY_THRESHOLD);
+
+	if (UNLIKELY(size >= LGMALLOC_MMAP_THRESHOLD))
+		return heap_alloc_mmap(heap, size);
+
+	/* A zero class means no class can hold the size,
+	 * which can only happen right below the threshold */
+	size_t class = get_size_class(size);
+
+	if (LIKELY(class))
+		return heap_bin_pop(heap, class);
+
+	return heap_alloc_mmap(heap, size);
+}
+
+#if defined(LGMALLOC_PERCPU)
+static ALWAYS_INLINE HOT_CALL
+void *percpu_alloc(size_t size);
+
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+void percpu_free(void *ptr);
+
+static NO_INLINE
+void *percpu_alloc_aligned(size_t size, size_t alignment, size_t class);
+#endif
+
+MALLOC_CALL(2) HOT_CALL NO_INLINE NO_NULL_ARGS
+void *heap_alloc(heap_t *heap, size_t size)
+{
+	GUARANTEE(size, "size must not be 0");
+
+#if defined(LGMALLOC_PERCPU)
+	if (heap == __percpu_heap_g)
+		return percpu_alloc(size);
+#endif
+
+	if (size <= LGMALLOC_TINY_THRESHOLD)
+	{
+		void *block = do_tiny_alloc(heap, size);
+
+		if (LIKELY(block))
+			return block;
+	}
+
+	void *alloc = regular_heap_alloc(heap, size);
+
+	if (UNLIKELY(!alloc))
+		errno = errno != EAGAIN
+			  ? ENOMEM : EAGAIN;
+
+	return alloc;
+}
+
+/* First class at or above `size` whose blocks are all
+ * aligned to `alignment`, or 0 if none is. Blocks sit
+ * at multiples of their size from a chunk offset that
+ * is itself aligned, see `chunk_blocks_offset`. */
+static COLD_CALL
+size_t aligned_size_class(size_t size, size_t alignment)
+{
+	if (alignment > PAGE_SIZE || size >= LGMALLOC_MMAP_THRESHOLD)
+		return 0;
+
+	if (size < alignment)
+		size = alignment;
+
+	size_t class = size <= LGMALLOC_TINY_THRESHOLD
+				 ? (size + (LGMALLOC_SMALL_GRANULARITY - 1)) / LGMALLOC_SMALL_GRANULARITY
+				 : get_size_class(size);
+
+	if (UNLIKELY(!class))
+		return 0;
+
+	const size_class_t *classes	= get_size_classes();
+	const size_t count			= get_size_class_count();
+
+	for (; class < count; ++class)
+		if (!(classes[class].block_sz & (alignment - 1)))
+			return class;
+
+	return 0;
+}
+
+/* `alignment` must be a power of two. Alignments no
+ * class can honour get their own aligned mapping. */
+MALLOC_CALL(2) NO_INLINE NO_NULL_ARGS
+void *heap_alloc_aligned(heap_t *heap, size_t size, size_t alignment)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	if (alignment <= LGMALLOC_SMALL_GRANULARITY)
+		return heap_alloc(heap, size);
+
+	const size_t class = aligned_size_class(size, alignment);
+
+#if defined(LGMALLOC_PERCPU)
+	if (heap == __percpu_heap_g)
+		return percpu_alloc_aligned(size, alignment, class);
+#endif
+
+	void *alloc = class
+				? heap_bin_pop(heap, class)
+				: heap_alloc_mmap_aligned(heap, size, alignment);
+
+	if (UNLIKELY(!alloc))
+		errno = errno != EAGAIN
+			  ? ENOMEM : EAGAIN;
+
+	return alloc;
+}
+
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+void chunk_free_block(
+	heap_t *RESTRICT	heap,
+	chunk_t *RESTRICT	chunk,
+	void				*ptr)
+{
+	LGMALLOC_ASSERT(
+		(PTR_DIFF(ptr, chunk) - (ptrdiff_t)chunk_blocks_offset(chunk->block_size))
+			% (ptrdiff_t)chunk->block_size == 0,
+		"pointer is not the start of a block"
+	);
+
+	block_t *block		= (block_t*)ptr;
+	block->next			= chunk->free_list;
+	chunk->free_list	= block;
+
+	if (UNLIKELY(chunk->is_full))
+	{
+		chunk->is_full = 0;
+		heap_bin_push(heap, chunk);
+	}
+
+	if (UNLIKELY(!--chunk->blocks_in_use))
+		heap_purge_enqueue(heap, chunk);
+}
+
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+void heap_free_mmap(heap_t *RESTRICT heap, mmap_t *RESTRICT map)
+{
+	LGMALLOC_ASSERT(
+		map->cookie == LGMALLOC_MMAP_COOKIE(map),
+		"pointer was not allocated by lgmalloc"
+	);
+
+	mmap_t *victims = NULL;
+
+	heap_shared_lock(heap);
+
+	remove_dedicated_mmap(heap, map);
+
+	if (!heap_mmap_cache_put(heap, map, &victims))
+	{
+		map->next	= victims;
+		victims		= map;
+	}
+
+	heap_shared_unlock(heap);
+
+	unmap_dedicated_mmaps(victims);
+}
+
+/* Must only be called by the thread owning `heap` */
+static ALWAYS_INLINE NO_NULL_ARGS
+void heap_free_local(heap_t *RESTRICT heap, void *ptr)
+{
+	if (LIKELY(segment_map_contains(ptr)))
+	{
+		segment_t *segment	= segment_of(ptr);
+		chunk_t   *chunk	= chunk_of(segment, ptr);
+
+		GUARANTEE(chunk, "pointer is not within a chunk");
+
+		chunk_free_block(heap, chunk, ptr);
+		return;
+	}
+
+	heap_free_mmap(heap, mmap_of(ptr));
+}
+
+/* Multiple producers push, only the owner ever pops, and
+ * it always takes the whole list at once. So there is no
+ * ABA hazard and a plain CAS loop on the head suffices. */
+static NO_INLINE NO_NULL_ARGS
+void heap_free_remote(heap_t *heap, void *ptr)
+{
+	block_t *block	= (block_t*)ptr;
+	block_t *head	= atomic_load_explicit(
+		&heap->thread_free, memory_order_relaxed
+	);
+
+	do
+		block->next = head;
+	while (!atomic_compare_exchange_weak_explicit(
+		&heap->thread_free, &head, block,
+		memory_order_release, memory_order_relaxed
+	));
+}
+
+static ALWAYS_INLINE HOT_CALL
+heap_t *heap_owner_of(const void *ptr)
+{
+	if (LIKELY(segment_map_contains(ptr)))
+		return atomic_load_explicit(
+			&segment_of(ptr)->parent_heap,
+			memory_order_relaxed
+		);
+
+	return mmap_of(ptr)->parent_heap;
+}
+
+/* A segment may have been reclaimed by another heap while
+ * a free for it was already on its way here, such blocks
+ * are forwarded to whoever owns the segment now. */
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+void heap_drain_thread_free(heap_t *heap)
+{
+	block_t *block = atomic_exchange_explicit(
+		&heap->thread_free, NULL, memory_order_acquire
+	);
+
+	while (block)
+	{
+		block_t *next	= block->next;
+		heap_t  *owner	= heap_owner_of(block);
+
+		if (LIKELY(owner == heap))
+			heap_free_local(heap, block);
+		else
+			heap_free_remote(owner, block);
+
+		block = next;
+	}
+}
+
+/* Resolves the owning chunk in constant time. The segment
+ * map tells segment memory apart from dedicated mappings,
+ * the segment mask finds the segment header and the slice
+ * index finds the chunk. Nothing is ever traversed.
+ * 
+ * Memory owned by another thread's heap is queued on
+ * that heap instead, its owner frees it later. */
+HOT_CALL NO_INLINE NO_NULL_ARGS
+void heap_free(void *ptr)
+{
+#if defined(LGMALLOC_PERCPU)
+	/* Explicit heaps keep out of the per-CPU caches */
+	if (LIKELY(__percpu_heap_g) && LIKELY(heap_owner_of(ptr) == __percpu_heap_g))
+	{
+		percpu_free(ptr);
+		return;
+	}
+#endif
+
+	const uintptr_t tid = lgmalloc_get_tid();
+
+	if (LIKELY(segment_map_contains(ptr)))
+	{
+		segment_t *segment	= segment_of(ptr);
+		heap_t    *heap		= atomic_load_explicit(
+			&segment->parent_heap, memory_order_relaxed
+		);
+
+		if (LIKELY(atomic_load_explicit(&heap->tid, memory_order_relaxed) == tid))
+		{
+			chunk_t *chunk = chunk_of(segment, ptr);
+
+			GUARANTEE(chunk, "pointer is not within a chunk");
+
+			chunk_free_block(heap, chunk, ptr);
+			return;
+		}
+
+		heap_free_remote(heap, ptr);
+		return;
+	}
+
+	mmap_t *map = mmap_of(ptr);
+
+	if (LIKELY(atomic_load_explicit(&map->parent_heap->tid, memory_order_relaxed) == tid))
+		heap_free_mmap(map->parent_heap, map);
+	else
+		heap_free_remote(map->parent_heap, ptr);
+}
+
+/* Per-CPU caches.
+ *
+ * Instead of a heap per thread, every thread shares a
+ * single heap with a mutex per size class, fronted by
+ * a block cache per CPU and size class. The caches are
+ * only touched through restartable sequences, so the
+ * fast path needs neither atomics nor a lock, and
+ * cached memory is bounded by the CPU count rather
+ * than the thread count.
+ * 
+ * An empty bin is refilled to half its capacity under
+ * its class's lock, a full one is drained by half, so
+ * threads working on different classes never contend.
+ * Dedicated mappings are mapped and unmapped without
+ * holding any lock at all. Capacities
+ * are set per class so that a bin never caches more
+ * than LGMALLOC_PERCPU_CLASS_BYTES.
+ * 
+ * Without rseq, this mode quietly falls back to
+ * the regular per-thread heaps. */
+
+#if defined(LGMALLOC_PERCPU)
+static pthread_once_t	__percpu_once_g		= PTHREAD_ONCE_INIT;
+static percpu_cache_t	*__percpu_caches_g	= NULL;
+static size_t			__percpu_cpus_g		= 0;
+static size_t			__percpu_capacity_g[LGMALLOC_SIZE_CLASS_MAX];
+static pthread_mutex_t	__percpu_locks_g[LGMALLOC_SIZE_CLASS_MAX];
+
+static COLD_CALL
+void percpu_init(void)
+{
+	if (!rseq_available())
+		return;
+
+	const long cpus = sysconf(_SC_NPROCESSORS_CONF);
+
+	if (UNLIKELY(cpus <= 0))
+		return;
+
+	/* Untouched pages stay uncommitted, so only
+	 * CPUs actually in use cost any memory */
+	const size_t size		= ALIGN_UP((size_t)cpus * sizeof(percpu_cache_t), PAGE_SIZE);
+	percpu_cache_t *caches	= (percpu_cache_t*)memory_map(size);
+
+	if (UNLIKELY(!caches))
+		return;
+
+	heap_t *heap = heap_create();
+
+	if (UNLIKELY(!heap))
+	{
+		munmap(caches, size);
+		return;
+	}
+
+	heap_warm_start(heap);
+
+	/* No thread owns the shared heap, so nothing
+	 * ever takes an owner-only path for it */
+	atomic_store_explicit(&heap->tid, 0, memory_order_relaxed);
+
+	const size_class_t *classes	= get_size_classes();
+	const size_t count			= get_size_class_count();
+
+	for (size_t class = 1; class < count; ++class)
+	{
+		size_t capacity = LGMALLOC_PERCPU_CLASS_BYTES / classes[class].block_sz;
+
+		if (!capacity)
+			capacity = 1;
+		else if (capacity > LGMALLOC_PERCPU_SLOTS)
+			capacity = LGMALLOC_PERCPU_SLOTS;
+
+		__percpu_capacity_g[class] = capacity;
+
+		pthread_mutex_init(&__percpu_locks_g[class], NULL);
+	}
+
+	__percpu_cpus_g		= (size_t)cpus;
+	__percpu_caches_g	= caches;
+	__percpu_heap_g		= heap;
+}
+
+static ALWAYS_INLINE HOT_CALL
+void *percpu_pop(size_t class)
+{
+	struct rseq *rs = rseq_current();
+	void *block;
+
+	for (;;)
+	{
+		const uint32_t cpu = rseq_cpu_start(rs);
+
+		if (UNLIKELY(cpu >= __percpu_cpus_g))
+			return NULL;
+
+		const int ret = rseq_bin_pop(
+			rs, cpu, &__percpu_caches_g[cpu].bins[class], &block
+		);
+
+		if (LIKELY(ret > 0))
+			return block;
+
+		if (!ret)
+			return NULL;
+	}
+}
+
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+int percpu_push(size_t class, void *block)
+{
+	struct rseq *rs = rseq_current();
+
+	for (;;)
+	{
+		const uint32_t cpu = rseq_cpu_start(rs);
+
+		if (UNLIKELY(cpu >= __percpu_cpus_g))
+			return 0;
+
+		const int ret = rseq_bin_push(
+			rs, cpu, &__percpu_caches_g[cpu].bins[class],
+			block, __percpu_capacity_g[class]
+		);
+
+		if (LIKELY(ret >= 0))
+			return ret;
+	}
+}
+
+/* Dedicated mappings have no class, the heap
+ * locks around their lists on its own */
+static NO_INLINE COLD_CALL
+void *percpu_alloc_slow(size_t size, size_t class)
+{
+	void *batch[LGMALLOC_PERCPU_SLOTS];
+	size_t filled = 0;
+	void *block;
+
+	if (class)
+	{
+		pthread_mutex_lock(&__percpu_locks_g[class]);
+
+		if (LIKELY(block = heap_bin_pop(__percpu_heap_g, class)))
+			for (; filled < __percpu_capacity_g[class] / 2; ++filled)
+				if (!(batch[filled] = heap_bin_pop(__percpu_heap_g, class)))
+					break;
+
+		pthread_mutex_unlock(&__percpu_locks_g[class]);
+	}
+	else
+		block = heap_alloc_mmap(__percpu_heap_g, size);
+
+	if (UNLIKELY(!block))
+	{
+		errno = errno != EAGAIN
+			  ? ENOMEM : EAGAIN;
+		return NULL;
+	}
+
+	size_t pushed = 0;
+
+	for (; pushed < filled && percpu_push(class, batch[pushed]); ++pushed);
+
+	/* Migrated to a CPU whose bin was already full */
+	if (UNLIKELY(pushed < filled))
+	{
+		pthread_mutex_lock(&__percpu_locks_g[class]);
+
+		for (; pushed < filled; ++pushed)
+			chunk_free_block(
+				__percpu_heap_g, chunk_of(segment_of(batch[pushed]), batch[pushed]),
+				batch[pushed]
+			);
+
+		pthread_mutex_unlock(&__percpu_locks_g[class]);
+	}
+
+	return block;
+}
+
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+void percpu_free_slow(size_t class, void *ptr)
+{
+	if (!class)
+	{
+		heap_free_mmap(__percpu_heap_g, mmap_of(ptr));
+		return;
+	}
+
+	void *batch[LGMALLOC_PERCPU_SLOTS];
+	size_t drained = 0;
+
+	batch[drained++] = ptr;
+
+	for (; drained < __percpu_capacity_g[class] / 2 + 1; ++drained)
+		if (!(batch[drained] = percpu_pop(class)))
+			break;
+
+	pthread_mutex_lock(&__percpu_locks_g[class]);
+
+	for (size_t i = 0; i < drained; ++i)
+		chunk_free_block(
+			__percpu_heap_g, chunk_of(segment_of(batch[i]), batch[i]), batch[i]
+		);
+
+	pthread_mutex_unlock(&__percpu_locks_g[class]);
+}
+
+static ALWAYS_INLINE HOT_CALL
+void *percpu_alloc(size_t size)
+{
+	size_t class;
+
+	if (size <= LGMALLOC_TINY_THRESHOLD)
+		class = (size + (LGMALLOC_SMALL_GRANULARITY - 1))
+					  /  LGMALLOC_SMALL_GRANULARITY;
+	else if (UNLIKELY(size >= LGMALLOC_MMAP_THRESHOLD))
+		class = 0;
+	else
+		class = get_size_class(size);
+
+	if (LIKELY(class))
+	{
+		void *block = percpu_pop(class);
+
+		if (LIKELY(block))
+			return block;
+	}
+
+	return percpu_alloc_slow(size, class);
+}
+
+static NO_INLINE
+void *percpu_alloc_aligned(size_t size, size_t alignment, size_t class)
+{
+	if (LIKELY(class))
+	{
+		void *block = percpu_pop(class);
+
+		if (LIKELY(block))
+			return block;
+
+		return percpu_alloc_slow(size, class);
+	}
+
+	void *alloc = heap_alloc_mmap_aligned(__percpu_heap_g, size, alignment);
+
+	if (UNLIKELY(!alloc))
+		errno = errno != EAGAIN
+			  ? ENOMEM : EAGAIN;
+
+	return alloc;
+}
+
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+void percpu_free(void *ptr)
+{
+	if (LIKELY(segment_map_contains(ptr)))
+	{
+		const chunk_t *chunk = chunk_of(segment_of(ptr), ptr);
+
+		if (LIKELY(percpu_push(chunk->size_class, ptr)))
+			return;
+
+		percpu_free_slow(chunk->size_class, ptr);
+		return;
+	}
+
+	percpu_free_slow(0, ptr);
+}
+#endif /* LGMALLOC_PERCPU */
+
+/* Thread context.
+ *
+ * Every thread allocates from the heap behind this
+ * one pointer. It is defined here and only here, so
+ * all translation units agree on it, and clearing it
+ * on thread exit really cuts the thread off from a
+ * heap that may be adopted right after.
+ */
+
+_Thread_local TLS_MODEL
+heap_t *__current_thread_heap_g = 0;
+
+static _Thread_local TLS_MODEL
+uintptr_t __current_thread_tid_g = 0;
+
+static ALWAYS_INLINE COLD_CALL NO_NULL_ARGS
+void __set_current_thread_heap(heap_t *heap)
+{
+	__current_thread_heap_g = heap;
+}
+
+/* Only for the thread exit hook, which hands the
+ * heap back before the thread is fully gone */
+static ALWAYS_INLINE COLD_CALL
+void __clear_current_thread_heap(void)
+{
+	__current_thread_heap_g = 0;
+}
+
+static ALWAYS_INLINE PURE HOT_CALL
+heap_t *__unsafe_get_current_thread_heap(void)
+{
+	return __current_thread_heap_g;
+}
+
+/*
+ * There are two main approaches for initializing.
+ * You can configure these at compile-time.
+ *
+ * The default:
+ *     We make an assumption that the system has the resources
+ *     to allow us a larger memory footprint, allocating a massive
+ *     memory map where we can systematically allocate our malloc
+ *     structures on. This helps with syscall overhead, improves
+ *     locality, i.e. improving caching behavior, simplified
+ *     structure management and memory tracking and significantly
+ *     reducing memory fragmentation. This further benefits
+ *     from dynamic sizeclass determinations and possibly
+ *     malloc predictability at compile-time. Remember that
+ *     anything over `LGMALLOC_MMAP_THRESHOLD` (commonly 256kb)
+ *     will enter its own respective memory mapping logic.
+ * 
+ *     Though, this comes at a tradeoff: The initial footprint
+ *     will be significant, by allocating everything upfront.
+ *     This isn't too much of an issue in the context of libc_init
+ *     and long-life threads / daemons. Growth flexibility is also
+ *     significantly reduced, where structures might need to grow
+ *     independently. Finally, memory release granularity is flawed.
+ *     We can't release chunks of a memory map when they're no longer
+ *     needed. So essentially we're making the assumption that
+ *     we aren't in a constrained memory environment and the initial
+ *     overhead isn't a deal breaker.
+ *
+ * Multiple mmap calls:
+ *     This approach is much more viable for short-lived or constrained
+ *     systems. Where instead of having one big memory mapping for
+ *     everything we need, we create multiple memory maps for each
+ *     structure to grow independently, so that we can also release
+ *     these when they are no longer needed. This will significantly
+ *     reduce the memory footprint. Though, the initial performance
+ *     overhead will be more due to more system calls, memory tracking
+ *     and atomic operations. The memory footprint will also become
+ *     much more dynamic and no longer a constant throughout runtime.
+ * 
+ * Both approaches are configurable at compile-time during the build
+ * process. I recommend to use the multiple mmap calls approach for
+ * highly constrained systems, where system resources (particularly ram)
+ * are much more of a priority than speed and efficiency.
+ * 
+ * You should also consider that the implementation does a lot of
+ * heuristic determinations in order to reduce the mmap block's size.
+ * This is done by predetermening the size classes and usage of the
+ * allocator, which gives us a heuristic approach to optimize the
+ * allocator to the program's requirements and life-span.
+ */
+static COLD_CALL NO_INLINE
+void thread_ctx_init(void)
+{
+	if (UNLIKELY(__unsafe_get_current_thread_heap()))
+		return;
+
+	heap_t *heap = heap_acquire();
+
+	if (LIKELY(heap))
+		__set_current_thread_heap(heap);
+
+#if defined(LGMALLOC_ENABLE_PROFILING)
+	prof_thread_attach();
+#endif
+}
+
+HOT_CALL
+heap_t *__get_current_thread_heap(void)
+{
+	/* Avoid possible NULL in critical point. No weird unsafe
+	 * global thread fallbacks. It should be initialized.
+	 * The init function is responsible for proper init, 
+	 * there is also a possible recursion issue
+	 * here that needs special attention */
+	if (UNLIKELY(!__unsafe_get_current_thread_heap()))
+		thread_ctx_init();
+
+	return __unsafe_get_current_thread_heap();
+}
+
+static ALWAYS_INLINE COLD_CALL
+uintptr_t __get_tid(void)
+{
+#if !defined(__APPLE__) && (defined(__aarch64__) || defined(__x86_64__))
+	/* Should work because of clang / gcc */
+	return (uintptr_t)__builtin_thread_pointer();
+#else
+	uintptr_t tid;
+#if defined(__i386__)
+	__asm__("movl %%gs:0, %0" : "=r"(tid) : :);
+#elif defined(__x86_64__)
+#if defined(__MACH__)
+	__asm__("movq %%gs:0, %0" : "=r"(tid) : :);
+#else
+	__asm__("movq %%fs:0, %0" : "=r"(tid) : :);
+#endif
+#elif defined(__arm__)
+	__asm__ __volatile__("mrc p15, 0, %0, c13, c0, 3" : "=r"(tid));
+#elif defined(__aarch64__)
+#if defined(__MACH__)
+	__asm__ __volatile__("mrs %0, tpidrro_el0" : "=r"(tid));
+#else
+	__asm__ __volatile__("mrs %0, tpidr_el0" : "=r"(tid));
+#endif
+#else
+#if defined(SYS_gettid)
+	tid = (uintptr_t)syscall(SYS_gettid);
+	/* Fallback using unique thread heap address */
+	if (UNLIKELY(tid == (uintptr_t)-1))
+		tid = (uintptr_t)__get_current_thread_heap();
+#else
+	/* Direct fallback if SYS_gettid not available */
+	tid = (uintptr_t)__get_current_thread_heap();
+#endif
+#endif
+	return tid;
+#endif
+}
+
+HOT_CALL
+uintptr_t __lgmalloc_get_tid(void)
+{
+	if (UNLIKELY(!__current_thread_tid_g))
+		__current_thread_tid_g = __get_tid();
+
+	return __current_thread_tid_g;
+}
+
+EXTERN_STRONG_ALIAS(__lgmalloc_get_tid, lgmalloc_get_tid);
+EXTERN_STRONG_ALIAS(__get_current_thread_heap, get_current_thread_heap);
+
+/* Heap abandonment.
+ *
+ * Threads come and go far more often than heaps should.
+ * When a thread exits its heap is handed to a process
+ * wide pool instead of being leaked with everything
+ * still live in it. New threads adopt pooled heaps
+ * whole before mapping a fresh segment, and heaps
+ * running out of room reclaim segments from them.
+ *
+ * The pool is only touched on thread start, thread
+ * exit and when a heap needs a new segment, so
+ * a plain mutex is cheap enough to guard it.
+ */
+
+static pthread_mutex_t	__abandoned_lock_g		= PTHREAD_MUTEX_INITIALIZER;
+static heap_t			*__abandoned_heaps_g	= NULL;
+static size_t			__abandoned_count_g		= 0;
+
+static pthread_once_t	__thread_exit_once_g	= PTHREAD_ONCE_INIT;
+static pthread_key_t	__thread_exit_key_g;
+
+static COLD_CALL NO_NULL_ARGS
+void segment_free(segment_t *segment)
+{
+	segment_map_set(segment->mmap_start, 0);
+	munmap((void*)segment->mmap_start, segment->segment_size);
+}
+
+/* The heap structure lives in its first segment,
+ * so that one has to be unmapped last */
+static COLD_CALL NO_NULL_ARGS
+void heap_unmap_segments(heap_t *heap)
+{
+	segment_t *home		= segment_of(heap);
+	segment_t *segment	= heap->segment_list;
+
+	while (segment)
+	{
+		segment_t *next = segment->next;
+
+		if (segment != home)
+			segment_free(segment);
+
+		segment = next;
+	}
+
+	segment_free(home);
+}
+
+/* Visits every chunk carved off the segment once.
+ * Chunks spanning several slices appear once per
+ * slice in the chunk map, so repeats are skipped. */
+#define SEGMENT_FOR_EACH_CHUNK(segment, chunk)									\
+	for (chunk_t *__prev = NULL, *chunk = NULL,									\
+		 **__slot = (segment)->chunk_map +										\
+			(LGMALLOC_SEGMENT_META_SIZE >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT),	\
+		 **__end  = (segment)->chunk_map +										\
+			((segment)->chunk_top >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT);			\
+		 __slot < __end; __prev = chunk, ++__slot)								\
+		if ((chunk = *__slot) != __prev)
+
+static COLD_CALL NO_NULL_ARGS
+int heap_is_empty(heap_t *heap)
+{
+	if (heap->mmap_count)
+		return 0;
+
+	for (segment_t *segment = heap->segment_list; segment; segment = segment->next)
+		SEGMENT_FOR_EACH_CHUNK(segment, chunk)
+			if (chunk->blocks_in_use)
+				return 0;
+
+	return 1;
+}
+
+/* Registered as the destructor of a thread specific key,
+ * so it runs on thread exit for every thread with a heap.
+ * 
+ * An empty heap can't receive frees anymore, so it's
+ * safe to unmap once the pool holds enough of them.
+ * Heaps that donated segments are kept regardless,
+ * a free for a donated segment might still be on
+ * its way to this heap's `thread_free` list. */
+static COLD_CALL
+void heap_thread_exit(void *arg)
+{
+	heap_t *heap = (heap_t*)arg;
+
+	__clear_current_thread_heap();
+	heap_drain_thread_free(heap);
+
+	mmap_t *victims = NULL;
+
+	heap_mmap_cache_flush(heap, &victims);
+	unmap_dedicated_mmaps(victims);
+
+	heap_purge_lock(heap);
+	heap_purge_decay(heap, UINT64_MAX, 1);
+	heap_purge_unlock(heap);
+
+	pthread_mutex_lock(&__abandoned_lock_g);
+
+	atomic_store_explicit(&heap->tid, 0, memory_order_release);
+
+	if (__abandoned_count_g >= LGMALLOC_ABANDONED_HEAPS_MAX &&
+		!heap->segments_donated && heap_is_empty(heap))
+	{
+		pthread_mutex_unlock(&__abandoned_lock_g);
+		heap_unregister(heap);
+		heap_unmap_segments(heap);
+		return;
+	}
+
+	heap->next_abandoned = __abandoned_heaps_g;
+	__abandoned_heaps_g  = heap;
+	++__abandoned_count_g;
+
+	pthread_mutex_unlock(&__abandoned_lock_g);
+}
+
+static COLD_CALL
+void heap_thread_exit_key_init(void)
+{
+	pthread_key_create(&__thread_exit_key_g, heap_thread_exit);
+}
+
+/* Moves the segment's chunks with free blocks from the
+ * donor's bins into the heap's. Full chunks aren't in
+ * any bin, they rejoin the new owner's once freed.
+ * Queued chunks move between purge queues and keep
+ * their stamp, which at worst delays purges queued
+ * behind them a little, purged chunks move between
+ * purged bins. Both purge locks are held. */
+static COLD_CALL NO_NULL_ARGS
+void segment_migrate_chunks(
+	segment_t *RESTRICT	segment,
+	heap_t *RESTRICT	donor,
+	heap_t *RESTRICT	heap)
+{
+	SEGMENT_FOR_EACH_CHUNK(segment, chunk)
+	{
+		if (chunk->is_full)
+			continue;
+
+		if (chunk->is_queued)
+		{
+			heap_purge_dequeue(donor, chunk);
+			heap_purge_append(heap, chunk);
+			continue;
+		}
+
+		if (chunk->is_purged)
+		{
+			heap_purged_remove(donor, chunk);
+			heap_purged_push(heap, chunk);
+			continue;
+		}
+
+		heap_bin_remove(donor, chunk);
+		heap_bin_push(heap, chunk);
+	}
+}
+
+/* Takes a segment from an abandoned heap. The donor's home
+ * segment stays behind since the donor structure lives in
+ * it. Holding the pool lock makes us the donor's only
+ * user, so draining its `thread_free` here is safe. */
+static COLD_CALL NO_NULL_ARGS
+segment_t *heap_reclaim_segment(heap_t *heap)
+{
+	segment_t *segment = NULL;
+
+	pthread_mutex_lock(&__abandoned_lock_g);
+
+	for (heap_t *donor = __abandoned_heaps_g; donor; donor = donor->next_abandoned)
+	{
+		segment_t  *home = segment_of(donor);
+		segment_t **link = &donor->segment_list;
+
+		for (; *link && *link == home; link = &(*link)->next);
+
+		if (!*link)
+			continue;
+
+		heap_drain_thread_free(donor);
+
+		segment = *link;
+		*link   = segment->next;
+
+		--donor->segment_count;
+		++donor->segments_donated;
+
+		heap_purge_lock(donor);
+		heap_purge_lock(heap);
+		segment_migrate_chunks(segment, donor, heap);
+		heap_purge_unlock(heap);
+		heap_purge_unlock(donor);
+		break;
+	}
+
+	pthread_mutex_unlock(&__abandoned_lock_g);
+
+	if (segment)
+		heap_attach_segment(heap, segment);
+
+	return segment;
+}
+
+/* Heap for a new thread, adopting an abandoned one if
+ * possible. Either way the heap is handed back to the
+ * pool by `heap_thread_exit` once the thread exits. */
+COLD_CALL NO_INLINE
+heap_t *heap_acquire(void)
+{
+#if defined(LGMALLOC_PERCPU)
+	pthread_once(&__percpu_once_g, percpu_init);
+
+	if (__percpu_heap_g)
+		return __percpu_heap_g;
+#endif
+
+	pthread_once(&__thread_exit_once_g, heap_thread_exit_key_init);
+
+	pthread_mutex_lock(&__abandoned_lock_g);
+
+	heap_t *heap = __abandoned_heaps_g;
+
+	if (heap)
+	{
+		__abandoned_heaps_g = heap->next_abandoned;
+		--__abandoned_count_g;
+	}
+
+	pthread_mutex_unlock(&__abandoned_lock_g);
+
+	if (heap)
+	{
+		heap->next_abandoned = NULL;
+		atomic_store_explicit(&heap->tid, lgmalloc_get_tid(), memory_order_release);
+		heap_drain_thread_free(heap);
+	}
+	else if ((heap = heap_create()))
+		heap_warm_start(heap);
+
+	if (LIKELY(heap))
+		pthread_setspecific(__thread_exit_key_g, heap);
+
+	return heap;
+}
+
+/* Explicit heaps.
+ *
+ * Created through `heap_create` like any other heap but
+ * never tied to a thread's lifetime, so they are neither
+ * abandoned nor adopted and never donate segments. They
+ * belong to the creating thread, which alone allocates
+ * from and destroys them, other threads may only free.
+ *
+ * Destroying one unmaps everything it holds in one go,
+ * live allocations included. Blocks still on their way
+ * through `thread_free` are all its own, they go too.
+ */
+
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heap_destroy(heap_t *heap)
+{
+	LGMALLOC_ASSERT(
+		atomic_load_explicit(&heap->tid, memory_order_relaxed) == lgmalloc_get_tid(),
+		"heap must be destroyed by the thread that created it"
+	);
+
+	mmap_t *victims = NULL;
+
+	heap_unregister(heap);
+	heap_mmap_cache_flush(heap, &victims);
+
+	unmap_dedicated_mmaps(victims);
+	unmap_dedicated_mmaps(heap->mmap_list);
+
+	heap_unmap_segments(heap);
+}
+
+/* Usable bytes behind a pointer, which is the full block
+ * or mapping rather than the size originally requested */
+HOT_CALL NO_NULL_ARGS PURE
+size_t heap_usable_size(const void *ptr)
+{
+	if (LIKELY(segment_map_contains(ptr)))
+		return chunk_of(segment_of(ptr), ptr)->block_size;
+
+	return mmap_of(ptr)->size;
+}
+
+/* Bytes a request of `size` is actually given, the block
+ * size of its class, or whole pages for dedicated mappings */
+size_t heap_good_size(size_t size)
+{
+	if (UNLIKELY(!size))
+		size = 1;
+
+	size_t class = 0;
+
+	if (size <= LGMALLOC_TINY_THRESHOLD)
+		class = (size + (LGMALLOC_SMALL_GRANULARITY - 1))
+					  /  LGMALLOC_SMALL_GRANULARITY;
+	else if (size < LGMALLOC_MMAP_THRESHOLD)
+		class = get_size_class(size);
+
+	if (LIKELY(class))
+		return get_size_classes()[class].block_sz;
+
+	return align_size_to_page(size);
+}
+
+/* Whether a block can keep serving `size` bytes where it
+ * is, which is only while `size` maps to the block's own
+ * class. Anything else moves, so a block's class is always
+ * the one its last requested size maps to, which is what
+ * `heap_free_sized` relies on. */
+HOT_CALL NO_NULL_ARGS
+int heap_fits_in_place(const void *ptr, size_t size)
+{
+	if (UNLIKELY(!segment_map_contains(ptr)))
+		return 0;
+
+	const chunk_t *chunk = chunk_of(segment_of(ptr), ptr);
+
+	if (size > chunk->block_size)
+		return 0;
+
+	return get_size_class(size) == chunk->size_class;
+}
+
+/* Free for callers that still know the requested size.
+ * Any size a class holds can only have come from a chunk,
+ * so the size replaces the segment map probe, and its
+ * class is the block's own, see `heap_fits_in_place`.
+ * Per-CPU bins are indexed by it without touching the
+ * chunk header at all, heap owned blocks still need the
+ * chunk for its free list. Memory from the aligned
+ * allocation functions must go through `heap_free`. */
+HOT_CALL NO_INLINE NO_NULL_ARGS
+void heap_free_sized(void *ptr, size_t size)
+{
+	size_t class = 0;
+
+	if (LIKELY(size <= LGMALLOC_TINY_THRESHOLD))
+		class = (size + (LGMALLOC_SMALL_GRANULARITY - 1))
+					  /  LGMALLOC_SMALL_GRANULARITY;
+	else if (size < LGMALLOC_MMAP_THRESHOLD)
+		class = get_size_class(size);
+
+	if (UNLIKELY(!class))
+	{
+		heap_free(ptr);
+		return;
+	}
+
+	LGMALLOC_ASSERT(segment_map_contains(ptr), "size does not match the allocation");
+
+	segment_t *segment	= segment_of(ptr);
+	heap_t    *heap		= atomic_load_explicit(
+		&segment->parent_heap, memory_order_relaxed
+	);
+
+	LGMALLOC_ASSERT(
+		chunk_of(segment, ptr)->size_class == class,
+		"size does not match the allocation"
+	);
+
+#if defined(LGMALLOC_PERCPU)
+	if (LIKELY(heap == __percpu_heap_g))
+	{
+		if (LIKELY(percpu_push(class, ptr)))
+			return;
+
+		percpu_free_slow(class, ptr);
+		return;
+	}
+#endif
+
+	if (LIKELY(atomic_load_explicit(&heap->tid, memory_order_relaxed) == lgmalloc_get_tid()))
+	{
+		chunk_free_block(heap, chunk_of(segment, ptr), ptr);
+		return;
+	}
+
+	heap_free_remote(heap, ptr);
+}
+
+/* Resizes a dedicated mapping through the page tables
+ * instead of copying it. Returns NULL whenever the caller
+ * should fall back to allocating and copying: the pointer
+ * isn't a dedicated mapping, another thread owns it, the
+ * new size belongs in a chunk or the kernel refused.
+ * 
+ * Only the owner may resize, the list neighbours of the
+ * mapping hold its address and have to be relinked. */
+NO_INLINE NO_NULL_ARGS
+void *heap_remap(void *ptr, size_t size)
+{
+#if defined(__linux__) && defined(MREMAP_MAYMOVE)
+	if (UNLIKELY(size < LGMALLOC_MMAP_THRESHOLD) || segment_map_contains(ptr))
+		return NULL;
+
+	mmap_t *map  = mmap_of(ptr);
+	heap_t *heap = map->parent_heap;
+
+	if (UNLIKELY(atomic_load_explicit(&heap->tid, memory_order_relaxed)
+				 != lgmalloc_get_tid()))
+		return NULL;
+
+	/* A moved aligned mapping would lose its alignment */
+	if (UNLIKELY((void*)map != map->alloc))
+		return NULL;
+
+	size = align_size_to_page(size);
+
+	if (size == map->size)
+		return ptr;
+
+	remove_dedicated_mmap(heap, map);
+
+	void *alloc = mremap(
+		map->alloc,
+		map->size + LGMALLOC_MMAP_T_SIZE,
+		size + LGMALLOC_MMAP_T_SIZE,
+		MREMAP_MAYMOVE
+	);
+
+	if (UNLIKELY(alloc == MAP_FAILED))
+	{
+		store_dedicated_mmap(heap, map);
+		return NULL;
+	}
+
+	map			= (mmap_t*)alloc;
+	map->alloc	= alloc;
+	map->size	= size;
+	map->cookie	= LGMALLOC_MMAP_COOKIE(map);
+
+	store_dedicated_mmap(heap, map);
+
+	return OFFSET_PTR(map, LGMALLOC_MMAP_T_SIZE);
+#else
+	DISCARD_ARGS(ptr, size);
+	return NULL;
+#endif
+}
+
+/* Allocation for a call site whose default class was
+ * resolved at compile time, see `lgmalloc` in lgmalloc.h */
+MALLOC_CALL(3) HOT_CALL NO_INLINE NO_NULL_ARGS
+void *heap_alloc_class(heap_t *heap, size_t class, size_t size)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	class = get_remapped_size_class(class, size);
+
+	if (UNLIKELY(!class))
+		return heap_alloc(heap, size);
+
+#if defined(LGMALLOC_PERCPU)
+	if (heap == __percpu_heap_g)
+	{
+		void *block = percpu_pop(class);
+
+		return LIKELY(block) ? block : percpu_alloc_slow(size, class);
+	}
+#endif
+
+	void *alloc = heap_bin_pop(heap, class);
+
+	if (UNLIKELY(!alloc))
+		errno = errno != EAGAIN
+			  ? ENOMEM : EAGAIN;
+
+	return alloc;
+}
+
+/* Batch allocation.
+ *
+ * The size class is resolved once and each chunk hands
+ * out as many blocks as it has left in a single pass,
+ * updating its counters and bin membership only once.
+ * Returns how many blocks were allocated, fewer than
+ * `count` only if memory ran out. */
+NO_INLINE NO_NULL_ARGS
+size_t heap_alloc_batch(heap_t *heap, size_t size, size_t count, void **out)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	size_t class = 0;
+
+	if (size <= LGMALLOC_TINY_THRESHOLD)
+		class = (size + (LGMALLOC_SMALL_GRANULARITY - 1))
+					  /  LGMALLOC_SMALL_GRANULARITY;
+	else if (size < LGMALLOC_MMAP_THRESHOLD)
+		class = get_size_class(size);
+
+	size_t done = 0;
+
+#if defined(LGMALLOC_PERCPU)
+	if (heap == __percpu_heap_g)
+		class = 0;
+#endif
+
+	/* Dedicated mappings gain nothing from batching */
+	if (UNLIKELY(!class))
+	{
+		for (; done < count; ++done)
+			if (UNLIKELY(!(out[done] = heap_alloc(heap, size))))
+				break;
+
+		return done;
+	}
+
+	while (done < count)
+	{
+		chunk_t *chunk = heap->chunk_bins[class];
+
+		if (UNLIKELY(!chunk) && !(chunk = heap_refill_bin(heap, class)))
+		{
+			errno = errno != EAGAIN
+				  ? ENOMEM : EAGAIN;
+			break;
+		}
+
+		size_t take = chunk->block_count - chunk->blocks_in_use;
+
+		if (take > count - done)
+			take = count - done;
+
+		chunk->blocks_in_use += take;
+
+		for (block_t *block = chunk->free_list; take && block; --take)
+		{
+			out[done++]			= block;
+			chunk->free_list	= block = block->next;
+		}
+
+		for (; take; --take)
+		{
+			out[done++]			= (void*)chunk->frontier;
+			chunk->frontier		+= chunk->block_size;
+		}
+
+		if (chunk->blocks_in_use == chunk->block_count)
+		{
+			chunk->is_full = 1;
+			heap_bin_remove(heap, chunk);
+		}
+	}
+
+	return done;
+}
+
+/* Batch free.
+ *
+ * Pointers into chunks the calling thread owns are
+ * grouped by chunk, linked up locally and spliced onto
+ * each chunk's free list at once, so its counters and
+ * bin membership are updated once per group. Pending
+ * groups sit in a small table indexed by the chunk's
+ * slice, a group is only flushed early when another
+ * chunk needs its slot. Nothing is allocated, so
+ * interleaving more chunks than slots just splits
+ * groups. Everything else takes the regular path.
+ */
+
+#define LGMALLOC_FREE_BATCH_SLOTS	16
+
+typedef struct
+{
+	chunk_t	*chunk;
+	heap_t	*heap;
+	block_t	*head;
+	block_t	*tail;
+	size_t	freed;
+}	free_batch_run_t;
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void free_batch_flush(free_batch_run_t *run)
+{
+	chunk_t *chunk = run->chunk;
+
+	run->tail->next		= chunk->free_list;
+	chunk->free_list	= run->head;
+
+	if (UNLIKELY(chunk->is_full))
+	{
+		chunk->is_full = 0;
+		heap_bin_push(run->heap, chunk);
+	}
+
+	if (!(chunk->blocks_in_use -= run->freed))
+		heap_purge_enqueue(run->heap, chunk);
+
+	run->chunk = NULL;
+}
+
+NO_INLINE NO_NULL_ARGS
+void heap_free_batch(void **ptrs, size_t count)
+{
+#if defined(LGMALLOC_PERCPU)
+	if (LIKELY(__percpu_heap_g))
+	{
+		for (size_t i = 0; i < count; ++i)
+			if (LIKELY(ptrs[i]))
+				heap_free(ptrs[i]);
+		return;
+	}
+#endif
+
+	free_batch_run_t runs[LGMALLOC_FREE_BATCH_SLOTS];
+
+	for (size_t i = 0; i < LGMALLOC_FREE_BATCH_SLOTS; ++i)
+		runs[i].chunk = NULL;
+
+	const uintptr_t tid = lgmalloc_get_tid();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		void *ptr = ptrs[i];
+
+		if (UNLIKELY(!ptr))
+			continue;
+
+		if (UNLIKELY(!segment_map_contains(ptr)))
+		{
+			heap_free(ptr);
+			continue;
+		}
+
+		segment_t *segment	= segment_of(ptr);
+		chunk_t   *chunk	= chunk_of(segment, ptr);
+		block_t   *block	= (block_t*)ptr;
+
+		free_batch_run_t *run = &runs[
+			((uintptr_t)chunk >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT)
+				% LGMALLOC_FREE_BATCH_SLOTS
+		];
+
+		/* A pending group means its heap is ours already */
+		if (LIKELY(run->chunk == chunk))
+		{
+			block->next	= run->head;
+			run->head	= block;
+			++run->freed;
+			continue;
+		}
+
+		heap_t *heap = atomic_load_explicit(
+			&segment->parent_heap, memory_order_relaxed
+		);
+
+		if (UNLIKELY(atomic_load_explicit(&heap->tid, memory_order_relaxed) != tid))
+		{
+			heap_free_remote(heap, ptr);
+			continue;
+		}
+
+		if (run->chunk)
+			free_batch_flush(run);
+
+		*run = (free_batch_run_t){
+			.chunk	= chunk,
+			.heap	= heap,
+			.head	= block,
+			.tail	= block,
+			.freed	= 1
+		};
+	}
+
+	for (size_t i = 0; i < LGMALLOC_FREE_BATCH_SLOTS; ++i)
+		if (runs[i].chunk)
+			free_batch_flush(&runs[i]);
+}
+
+/* Regions.
+ *
+ * Blocks are plain mappings, not segments, since region
+ * memory is never freed on its own and so never needs
+ * to find a chunk. Allocations are aligned like the
+ * smallest size class, one compare and one add.
+ */
+
+static ALWAYS_INLINE PURE NO_NULL_ARGS
+uintptr_t region_block_start(const region_t *region, const region_block_t *block)
+{
+	/* The first block also holds the region itself */
+	return block == region->first
+		 ? (uintptr_t)region + LGMALLOC_REGION_T_SIZE
+		 : (uintptr_t)block  + LGMALLOC_REGION_BLOCK_T_SIZE;
+}
+
+static ALWAYS_INLINE NO_NULL_ARGS
+void region_use_block(region_t *RESTRICT region, region_block_t *RESTRICT block)
+{
+	region->current	= block;
+	region->cursor	= region_block_start(region, block);
+	region->end		= (uintptr_t)block + block->size;
+}
+
+static MALLOC_CALL(1) COLD_CALL
+region_block_t *region_block_map(size_t size)
+{
+	size = ALIGN_UP(size, PAGE_SIZE);
+
+	region_block_t *block = memory_map(size);
+
+	if (UNLIKELY(!block))
+		return NULL;
+
+	block->next = NULL;
+	block->size = size;
+
+	return block;
+}
+
+COLD_CALL NO_INLINE
+region_t *region_create(void)
+{
+	region_block_t *block = region_block_map(LGMALLOC_REGION_BLOCK_SIZE);
+
+	if (UNLIKELY(!block))
+		return NULL;
+
+	region_t *region = OFFSET_PTR(block, LGMALLOC_REGION_BLOCK_T_SIZE);
+
+	region->first = block;
+	region_use_block(region, block);
+
+	return region;
+}
+
+/* Moves on to the next block kept from before the last
+ * reset that fits, otherwise maps one right after the
+ * current block. Skipped blocks stay unused until the
+ * next reset. */
+static NO_INLINE COLD_CALL NO_NULL_ARGS
+void *region_alloc_slow(region_t *region, size_t size)
+{
+	region_block_t *block = region->current->next;
+
+	for (; block; block = block->next)
+		if (block->size - LGMALLOC_REGION_BLOCK_T_SIZE >= size)
+			break;
+
+	if (!block)
+	{
+		const size_t needed = size + LGMALLOC_REGION_BLOCK_T_SIZE;
+
+		block = region_block_map(
+			needed > LGMALLOC_REGION_BLOCK_SIZE
+				   ? needed : LGMALLOC_REGION_BLOCK_SIZE
+		);
+
+		if (UNLIKELY(!block))
+			return NULL;
+
+		block->next				= region->current->next;
+		region->current->next	= block;
+	}
+
+	region_use_block(region, block);
+
+	void *alloc = (void*)region->cursor;
+	region->cursor += size;
+
+	return alloc;
+}
+
+MALLOC_CALL(2) HOT_CALL NO_INLINE NO_NULL_ARGS
+void *region_alloc(region_t *region, size_t size)
+{
+	GUARANTEE(size, "size must not be 0");
+
+	size = ALIGN_UP(size, LGMALLOC_SMALL_GRANULARITY);
+
+	if (LIKELY(size <= region->end - region->cursor))
+	{
+		void *alloc = (void*)region->cursor;
+		region->cursor += size;
+		return alloc;
+	}
+
+	void *alloc = region_alloc_slow(region, size);
+
+	if (UNLIKELY(!alloc))
+		errno = errno != EAGAIN
+			  ? ENOMEM : EAGAIN;
+
+	return alloc;
+}
+
+/* Constant time, every block stays mapped and committed */
+NO_NULL_ARGS
+void region_reset(region_t *region)
+{
+	region_use_block(region, region->first);
+}
+
+/* Keeps the blocks mapped but hands their pages back,
+ * touching them again gets fresh zeroed pages */
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void region_release(region_t *region)
+{
+	for (region_block_t *block = region->first; block; block = block->next)
+	{
+		const uintptr_t start = region_block_start(region, block);
+
+		vm_decommit_aligned(
+			(void*)start,
+			(uintptr_t)block + block->size - start
+		);
+	}
+
+	region_reset(region);
+}
+
+/* The first block holds the region, so it goes last */
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void region_destroy(region_t *region)
+{
+	region_block_t *first = region->first;
+	region_block_t *block = first->next;
+
+	while (block)
+	{
+		region_block_t *next = block->next;
+		munmap(block, block->size);
+		block = next;
+	}
+
+	munmap(first, first->size);
+}
+
+/* Hands back everything the heap holds on to without
+ * needing it, empty chunks and cached mappings, right
+ * away rather than once they decayed. Returns whether
+ * there was anything to hand back. */
+COLD_CALL NO_INLINE NO_NULL_ARGS
+int heap_trim(heap_t *heap)
+{
+	mmap_t *victims = NULL;
+
+	/* Nothing is ever handed back to the shared heap remotely */
+	if (!heap_is_shared(heap))
+		heap_drain_thread_free(heap);
+
+	heap_shared_lock(heap);
+
+	int released = heap->mmap_cache_count != 0;
+
+	heap_mmap_cache_flush(heap, &victims);
+
+	heap_shared_unlock(heap);
+
+	unmap_dedicated_mmaps(victims);
+
+	heap_purge_lock(heap);
+
+	released |= heap->purge_head != NULL;
+	heap_purge_decay(heap, UINT64_MAX, 1);
+
+	heap_purge_unlock(heap);
+
+	return released;
 }
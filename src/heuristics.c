@@ -0,0 +1,338 @@
+/* ******************************************** */
+/*                                              */
+/*   heuristics.c                               */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#define _GNU_SOURCE
+
+#include "internal/lgmalloc_global_include.h"
+#include "internal/lgmalloc_heuristics.h"
+#include "api/lgmalloc.h"
+
+#include <link.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Finding the heuristics entries.
+ *
+ * Section headers aren't part of any loaded segment, so
+ * every object reported by `dl_iterate_phdr` is mapped
+ * again read only from its file, just long enough to
+ * walk its section headers for our sections. Entry
+ * sizes come from that file image.
+ *
+ * The entries are thread local, so the live copy of a
+ * section sits in the calling thread's TLS block of the
+ * object, at the section's offset into the TLS template.
+ * That's where the frequencies come from. Objects whose
+ * TLS the thread hasn't touched yet count 0.
+ *
+ * Nothing here may allocate, this runs inside the
+ * allocator's own initialization.
+ */
+
+/* Call sites of the public `lgmalloc` macro emit their
+ * own copy of the entry, see api/lgmalloc.h */
+_Static_assert(
+	sizeof(__lgmalloc_site_t) == sizeof(lgmalloc_heuristic_entry_t)					&&
+	offsetof(__lgmalloc_site_t, size)		== offsetof(lgmalloc_heuristic_entry_t, size)		&&
+	offsetof(__lgmalloc_site_t, freq)		== offsetof(lgmalloc_heuristic_entry_t, freq)		&&
+	offsetof(__lgmalloc_site_t, is_const)	== offsetof(lgmalloc_heuristic_entry_t, is_const),
+	"lgmalloc.h call site entries don't match lgmalloc_heuristic_entry_t"
+);
+
+static lgmalloc_heuristics_t __heuristics_g;
+
+static pthread_once_t __heuristics_once_g = PTHREAD_ONCE_INIT;
+
+/* Entry of `size`, inserted sorted if it's new, or
+ * NULL once there's no room left for it */
+static COLD_CALL NO_NULL_ARGS
+lgmalloc_heuristic_size_t *heuristics_size_entry(lgmalloc_heuristics_t *h, size_t size)
+{
+	size_t lo = 0;
+	size_t hi = h->size_count;
+
+	while (lo < hi)
+	{
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (h->sizes[mid].size < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo < h->size_count && h->sizes[lo].size == size)
+		return h->sizes + lo;
+
+	if (UNLIKELY(h->size_count == LGMALLOC_HEURISTICS_MAX_SIZES))
+		return NULL;
+
+	memmove(
+		h->sizes + lo + 1, h->sizes + lo,
+		(h->size_count - lo) * sizeof(*h->sizes)
+	);
+
+	h->sizes[lo] = (lgmalloc_heuristic_size_t){ .size = size };
+
+	++h->size_count;
+
+	return h->sizes + lo;
+}
+
+/* A size seen before only adds up */
+static COLD_CALL NO_NULL_ARGS
+void heuristics_add_const(lgmalloc_heuristics_t *h, size_t size, size_t freq)
+{
+	lgmalloc_heuristic_size_t *entry = heuristics_size_entry(h, size);
+
+	if (UNLIKELY(!entry))
+	{
+		++h->dropped_sites;
+		return;
+	}
+
+	++entry->sites;
+	entry->freq += freq;
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heuristics_add_section(
+	lgmalloc_heuristics_t				*h,
+	const lgmalloc_heuristic_entry_t	*entries,
+	const lgmalloc_heuristic_entry_t	*live,
+	size_t								count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const size_t freq = live ? live[i].freq : 0;
+
+		if (!entries[i].is_const)
+		{
+			++h->runtime_sites;
+			h->runtime_freq += freq;
+			continue;
+		}
+
+		if (LIKELY(entries[i].size))
+			heuristics_add_const(h, entries[i].size, freq);
+	}
+}
+
+/* The main executable reports an empty name */
+static ALWAYS_INLINE COLD_CALL NO_NULL_ARGS
+const char *heuristics_object_path(const struct dl_phdr_info *info)
+{
+	return info->dlpi_name && *info->dlpi_name
+		 ? info->dlpi_name
+		 : "/proc/self/exe";
+}
+
+static ALWAYS_INLINE COLD_CALL NO_NULL_ARGS
+const ElfW(Phdr) *heuristics_tls_phdr(const struct dl_phdr_info *info)
+{
+	for (ElfW(Half) i = 0; i < info->dlpi_phnum; ++i)
+		if (info->dlpi_phdr[i].p_type == PT_TLS)
+			return info->dlpi_phdr + i;
+
+	return NULL;
+}
+
+static ALWAYS_INLINE COLD_CALL PURE
+int heuristics_in_bounds(size_t offset, size_t size, size_t limit)
+{
+	return offset <= limit && size <= limit - offset;
+}
+
+/* Any section named after ours, the constant size
+ * sections only differ by their suffix */
+static ALWAYS_INLINE COLD_CALL NO_NULL_ARGS
+int heuristics_is_our_section(const char *name, size_t room)
+{
+	const size_t len = sizeof(LGMALLOC_HEURISTICS_SECTION) - 1;
+
+	return room > len &&
+		   !memcmp(name, LGMALLOC_HEURISTICS_SECTION, len) &&
+		   (name[len] == '\0' || name[len] == '.');
+}
+
+static COLD_CALL NO_NULL_ARGS
+void heuristics_scan_image(
+	lgmalloc_heuristics_t		*h,
+	const struct dl_phdr_info	*info,
+	const unsigned char			*image,
+	size_t						image_size)
+{
+	if (image_size < sizeof(ElfW(Ehdr)))
+		return;
+
+	const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr)*)image;
+
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+		ehdr->e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+		ehdr->e_shentsize != sizeof(ElfW(Shdr)) || !ehdr->e_shoff)
+		return;
+
+	if (!heuristics_in_bounds(ehdr->e_shoff, sizeof(ElfW(Shdr)), image_size))
+		return;
+
+	const ElfW(Shdr) *shdrs = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+
+	/* Counts that don't fit their field live in the first header */
+	size_t shnum	= ehdr->e_shnum		? ehdr->e_shnum		: shdrs[0].sh_size;
+	size_t shstrndx	= ehdr->e_shstrndx	!= SHN_XINDEX		? ehdr->e_shstrndx
+															: shdrs[0].sh_link;
+
+	if (!heuristics_in_bounds(ehdr->e_shoff, shnum * sizeof(ElfW(Shdr)), image_size) ||
+		shstrndx >= shnum)
+		return;
+
+	const ElfW(Shdr) *strtab = shdrs + shstrndx;
+
+	if (!heuristics_in_bounds(strtab->sh_offset, strtab->sh_size, image_size))
+		return;
+
+	const char *names		= (const char*)(image + strtab->sh_offset);
+	const ElfW(Phdr) *tls	= heuristics_tls_phdr(info);
+
+	for (size_t i = 0; i < shnum; ++i)
+	{
+		const ElfW(Shdr) *shdr = shdrs + i;
+
+		if (shdr->sh_name >= strtab->sh_size ||
+			!heuristics_is_our_section(names + shdr->sh_name, strtab->sh_size - shdr->sh_name))
+			continue;
+
+		/* Nothing but zeroes, there's no size to learn */
+		if (shdr->sh_type == SHT_NOBITS ||
+			!heuristics_in_bounds(shdr->sh_offset, shdr->sh_size, image_size))
+			continue;
+
+		const size_t count = shdr->sh_size / sizeof(lgmalloc_heuristic_entry_t);
+
+		const lgmalloc_heuristic_entry_t *live = NULL;
+
+		if (shdr->sh_flags & SHF_TLS)
+		{
+			if (tls && info->dlpi_tls_data && shdr->sh_addr >= tls->p_vaddr)
+				live = OFFSET_PTR(info->dlpi_tls_data, shdr->sh_addr - tls->p_vaddr);
+		}
+		else if (shdr->sh_flags & SHF_ALLOC)
+			live = (const lgmalloc_heuristic_entry_t*)(info->dlpi_addr + shdr->sh_addr);
+
+		heuristics_add_section(
+			h, (const lgmalloc_heuristic_entry_t*)(image + shdr->sh_offset),
+			live, count
+		);
+	}
+}
+
+/* Objects without a file behind them, like the vDSO,
+ * simply fail to open and are skipped. `arg` is where
+ * the entries add up. */
+static COLD_CALL
+int heuristics_scan_object(struct dl_phdr_info *info, size_t size, void *arg)
+{
+	DISCARD_ARGS(size);
+
+	const int fd = open(heuristics_object_path(info), O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+
+	if (fstat(fd, &st) || st.st_size <= 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void *image = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (image == MAP_FAILED)
+		return 0;
+
+	heuristics_scan_image(arg, info, image, (size_t)st.st_size);
+
+	munmap(image, (size_t)st.st_size);
+
+	return 0;
+}
+
+static COLD_CALL
+void __heuristics_collect(void)
+{
+	dl_iterate_phdr(heuristics_scan_object, &__heuristics_g);
+}
+
+/* Objects loaded after this call aren't accounted for */
+COLD_CALL NO_INLINE
+void heuristics_collect(void)
+{
+	pthread_once(&__heuristics_once_g, __heuristics_collect);
+}
+
+PURE
+const lgmalloc_heuristics_t *heuristics_get(void)
+{
+	return &__heuristics_g;
+}
+
+/* The entries as they are right now, with the calling
+ * thread's frequencies, the collected ones stay as is */
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heuristics_snapshot(lgmalloc_heuristics_t *out)
+{
+	memset(out, 0, sizeof(*out));
+
+	dl_iterate_phdr(heuristics_scan_object, out);
+}
+
+/* Folds `other` into `h`. Call sites are the same ones
+ * from run to run and from thread to thread, so they
+ * don't add up, frequencies do. */
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heuristics_fold(lgmalloc_heuristics_t *RESTRICT h, const lgmalloc_heuristics_t *RESTRICT other)
+{
+	for (size_t i = 0; i < other->size_count; ++i)
+	{
+		lgmalloc_heuristic_size_t *entry = heuristics_size_entry(h, other->sizes[i].size);
+
+		if (UNLIKELY(!entry))
+		{
+			h->dropped_sites += other->sizes[i].sites;
+			continue;
+		}
+
+		if (entry->sites < other->sizes[i].sites)
+			entry->sites = other->sizes[i].sites;
+
+		entry->freq += other->sizes[i].freq;
+	}
+
+	if (h->runtime_sites < other->runtime_sites)
+		h->runtime_sites = other->runtime_sites;
+
+	h->runtime_freq += other->runtime_freq;
+}
+
+/* Folds in what an earlier run saw, see profiling.c.
+ * Only before the size classes are built. */
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heuristics_merge(const lgmalloc_heuristics_t *other)
+{
+	heuristics_fold(&__heuristics_g, other);
+}
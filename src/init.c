@@ -7,9 +7,39 @@
 /* ******************************************** */
 
 #include "internal/lgmalloc_global_include.h"
+#include "internal/lgmalloc_size_classes.h"
+#include "internal/lgmalloc_heuristics.h"
+
+#include <limits.h>
+#include <pthread.h>
 
 static int __is_lgmalloc_init_g = 0;
 
+/* The size classes in use, shared by every
+ * thread and read only once they're built */
+size_class_t	__size_classes_g[LGMALLOC_SIZE_CLASS_MAX];
+size_t			__size_class_count_g			= 0;
+uint8_t			__size_class_remap_g[LGMALLOC_DEFAULT_SIZE_CLASS_COUNT];
+size_t			__default_size_class_count_g	= 0;
+
+static pthread_once_t __size_classes_once_g = PTHREAD_ONCE_INIT;
+
+/* Removes the classes above the mmap threshold,
+ * then applies the heuristics to better determine
+ * the exact classes */
+static COLD_CALL
+void __size_classes_build(void)
+{
+	__clean_size_classes();
+	__apply_size_class_heuristics();
+}
+
+COLD_CALL NO_INLINE
+void size_classes_init(void)
+{
+	pthread_once(&__size_classes_once_g, __size_classes_build);
+}
+
 static ALWAYS_INLINE HOT_CALL
 void lgmalloc_set_init(int value)
 {
@@ -49,30 +79,72 @@ int lgmalloc_is_init(void)
  * constant sized allocation of (for example) 1mb will
  * clog up memory the more threads you create.
  *
- *		+----------------------+  <- Start
- *		| Heap structure       |
- *		+----------------------+  <- + sizeof(heap_t)
+ * Chunk headers are only written once a size class
+ * first needs a chunk, and blocks are carved off a
+ * chunk's frontier as they are handed out. Nothing
+ * is pre-formatted, so pages are only faulted in
+ * as the allocation frontier reaches them.
+ *
+ *		+----------------------+  <- Start (segment aligned)
  *		| Segment structure    |
  *		+----------------------+  <- + sizeof(segment_t)
+ *		| Heap structure       |
+ *		| Unused metadata room |
+ *		+----------------------+  <- Start + segment metadata size
  *		| Chunk structure 1    |
- *		+----------------------+  <- + sizeof(chunk_t)
- *		| Block structure 1    |
- *		+----------------------+  <- + sizeof(block_t)
- *		| Raw memory for use   |
- *		+----------------------+  <- + block_1->size
- *		| Block structure 2    |
- *		+----------------------+  <- + sizeof(block_t)
- *		| Raw memory for use   |
- *		+----------------------+  <- + block_2->size
- *		| Block structure ...  |
- *		+----------------------+  <- + sizeof(block_t)
- *		| Raw memory for use   |
- *		+----------------------+  <- + block_n->size
+ *		+----------------------+  <- + LGMALLOC_CHUNK_HEADER_SIZE
+ *		| Block 1              |
+ *		+----------------------+  <- + chunk_1->block_size
+ *		| Block 2              |
+ *		+----------------------+  <- + chunk_1->block_size
+ *		| Block ...            |
+ *		+----------------------+  <- chunk_1->frontier
+ *		| Uncarved, untouched  |
+ *		+----------------------+  <- + chunk span
  *		| Chunk structure ...  |
- *		+----------------------+  <- + sizeof(chunk_t)
+ *		+----------------------+  <- segment->chunk_top
+ *		| Unused, untouched    |
+ *		+----------------------+  <- + LGMALLOC_SEGMENT_SIZE
+ *
+ * The size is what the metadata and one chunk of every
+ * class the constant sized call sites ask for take up.
+ * Without any heuristics there's nothing to go by and
+ * it's the full segment.
  */
 size_t calculate_init_mmap_layout_size(void)
 {
+	const lgmalloc_heuristics_t *heuristics = heuristics_get();
+
+	if (!heuristics->size_count)
+		return LGMALLOC_SEGMENT_SIZE;
+
+	/* Several sizes can share one class */
+	uintptr_t seen[LGMALLOC_SIZE_CLASS_MAX / (sizeof(uintptr_t) * CHAR_BIT)] = {0};
+
+	const size_t word_bits = sizeof(uintptr_t) * CHAR_BIT;
+
+	size_t layout = LGMALLOC_SEGMENT_META_SIZE;
+
+	for (size_t i = 0; i < heuristics->size_count; ++i)
+	{
+		const size_t size = heuristics->sizes[i].size;
+
+		/* Sorted, everything from here gets its own mapping */
+		if (size >= LGMALLOC_MMAP_THRESHOLD)
+			break;
+
+		const size_t class = get_size_class(size);
+
+		if (UNLIKELY(!class) || seen[class / word_bits] & ((uintptr_t)1 << (class % word_bits)))
+			continue;
+
+		seen[class / word_bits] |= (uintptr_t)1 << (class % word_bits);
+
+		layout += heap_chunk_span(class);
+	}
+
+	return layout < LGMALLOC_SEGMENT_SIZE
+		 ? layout : LGMALLOC_SEGMENT_SIZE;
 }
 
 /* For scope and responsibility reasons this is
@@ -84,10 +156,15 @@ void lgmalloc_init(void)
 	if (UNLIKELY(__lgmalloc_is_init()))
 		return;
 
+	/* The size classes are derived from the
+	 * heuristics, and whatever a persisted
+	 * profile adds to them, before any use */
+	heuristics_collect();
+	init_prof_system();
+	size_classes_init();
+
 	/* Only compiled in debug builds */
 	do_debug_tests();
 
-	init_prof_system();
-
 	lgmalloc_set_init(1);
 }
@@ -17,4 +17,87 @@
 
 #define LGMALLOC_ENABLE_DECOMMIT
 
+/* Opt-in, back segments with huge pages. Empty
+ * chunks of such segments are never purged, their
+ * headers share the huge page with their blocks. */
+/* #define LGMALLOC_ENABLE_HUGEPAGES */
+
+#ifndef LGMALLOC_HUGE_PAGE_SIZE
+#define LGMALLOC_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+#endif
+
+/* Bytes of freed dedicated mappings each heap keeps
+ * for reuse, and how long one may sit unused before
+ * it's handed back to the kernel. 0 disables it. */
+#ifndef LGMALLOC_MMAP_CACHE_MAX_BYTES
+#define LGMALLOC_MMAP_CACHE_MAX_BYTES	(64 * 1024 * 1024)
+#endif
+
+#ifndef LGMALLOC_MMAP_CACHE_DECAY_MS
+#define LGMALLOC_MMAP_CACHE_DECAY_MS	1000
+#endif
+
+/* How long an empty chunk keeps its pages before
+ * they're handed back, 0 purges right away */
+#ifndef LGMALLOC_PURGE_DECAY_MS
+#define LGMALLOC_PURGE_DECAY_MS	1000
+#endif
+
+/* Opt-in, place segments and large mappings of
+ * each heap on the NUMA node that created it */
+/* #define LGMALLOC_ENABLE_NUMA */
+
+/* Opt-in, share one heap between all threads behind
+ * per-CPU caches using restartable sequences, each
+ * caching at most LGMALLOC_PERCPU_CLASS_BYTES of a
+ * size class. Falls back to per-thread heaps where
+ * rseq isn't available. */
+/* #define LGMALLOC_ENABLE_PERCPU */
+
+#ifndef LGMALLOC_PERCPU_CLASS_BYTES
+#define LGMALLOC_PERCPU_CLASS_BYTES	(256 * 1024)
+#endif
+
+/* Opt-in, a thread purging decayed chunks of every heap
+ * periodically, including heaps of idle threads */
+/* #define LGMALLOC_ENABLE_BACKGROUND_PURGE */
+
+#ifndef LGMALLOC_BACKGROUND_PURGE_INTERVAL_MS
+#define LGMALLOC_BACKGROUND_PURGE_INTERVAL_MS	1000
+#endif
+
+/* Bytes each region maps at a time, allocations
+ * that don't fit get a block of their own size */
+#ifndef LGMALLOC_REGION_BLOCK_SIZE
+#define LGMALLOC_REGION_BLOCK_SIZE	(1024 * 1024)
+#endif
+
+/* Distinct constant allocation sizes the startup
+ * heuristics keep track of, any beyond are dropped */
+#ifndef LGMALLOC_HEURISTICS_MAX_SIZES
+#define LGMALLOC_HEURISTICS_MAX_SIZES	256
+#endif
+
+/* Opt-in, the profiling system. With the environment
+ * variable LGMALLOC_PROFILE_ENV naming a file, each
+ * run also writes an allocation profile there at exit
+ * and the next run warm starts from it, carving at
+ * most LGMALLOC_PROFILE_MAX_CHUNKS chunks of a class
+ * up front in every new heap. */
+/* #define LGMALLOC_ENABLE_PROFILING */
+
+#ifndef LGMALLOC_PROFILE_ENV
+#define LGMALLOC_PROFILE_ENV	"LGMALLOC_PROFILE"
+#endif
+
+#ifndef LGMALLOC_PROFILE_MAX_CHUNKS
+#define LGMALLOC_PROFILE_MAX_CHUNKS	64
+#endif
+
+/* Empty heaps kept around for new threads to adopt
+ * once their thread exited, any beyond are unmapped */
+#ifndef LGMALLOC_ABANDONED_HEAPS_MAX
+#define LGMALLOC_ABANDONED_HEAPS_MAX	8
+#endif
+
 #endif /* __LGMALLOC_CONFIG_H */
@@ -10,12 +10,18 @@
 #define __LGMALLOC_DECOMMIT_H
 
 #include "lgmalloc_features.h"
+#include "lgmalloc_config.h"
 
+#include <sys/mman.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #ifdef LGMALLOC_ENABLE_DECOMMIT
 
+/* Huge page backed segments are never purged, see
+ * heap.c, so whatever gets here is regular pages */
+#define LGMALLOC_DECOMMIT_ALIGNMENT	PAGE_SIZE
+
 #if defined(__linux__)
 	/* Linux: Use MADV_DONTNEED to free physical pages */
 	#define __vm_decommit(ptr, size)					\
@@ -108,8 +114,8 @@ void vm_decommit_aligned(void *ptr, size_t size)
 	uintptr_t start = (uintptr_t)ptr;
 	uintptr_t end   = start + size;
 
-	uintptr_t page_start = ALIGN_UP(start, PAGE_SIZE);
-	uintptr_t page_end   = ALIGN_DOWN(end, PAGE_SIZE);
+	uintptr_t page_start = ALIGN_UP(start, LGMALLOC_DECOMMIT_ALIGNMENT);
+	uintptr_t page_end   = ALIGN_DOWN(end, LGMALLOC_DECOMMIT_ALIGNMENT);
 
 	if (UNLIKELY(page_end <= page_start))
 		return;
@@ -121,4 +127,37 @@ void vm_decommit_aligned(void *ptr, size_t size)
 #endif /* LGMALLOC_ENABLE_DECOMMIT */
 }
 
+/* Lazy variant, the kernel only reclaims the pages once
+ * it runs short on memory and until then reusing them
+ * costs nothing. With `force`, or where lazy freeing
+ * isn't supported, the pages are decommitted. */
+static ALWAYS_INLINE COLD_CALL NO_NULL_ARGS
+void vm_purge_aligned(void *ptr, size_t size, int force)
+{
+#if defined(LGMALLOC_ENABLE_DECOMMIT) && defined(MADV_FREE)
+	GUARANTEE(size, "size must not be 0");
+
+	if (force)
+	{
+		vm_decommit_aligned(ptr, size);
+		return;
+	}
+
+	uintptr_t start = (uintptr_t)ptr;
+	uintptr_t end   = start + size;
+
+	uintptr_t page_start = ALIGN_UP(start, LGMALLOC_DECOMMIT_ALIGNMENT);
+	uintptr_t page_end   = ALIGN_DOWN(end, LGMALLOC_DECOMMIT_ALIGNMENT);
+
+	if (UNLIKELY(page_end <= page_start))
+		return;
+
+	if (madvise((void*)page_start, page_end - page_start, MADV_FREE))
+		__vm_decommit((void*)page_start, page_end - page_start);
+#else
+	DISCARD_ARGS(force);
+	vm_decommit_aligned(ptr, size);
+#endif
+}
+
 #endif /* __LGMALLOC_DECOMMIT_H */
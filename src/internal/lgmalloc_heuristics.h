@@ -10,9 +10,13 @@
 #define __LGMALLOC_HEURISTICS_H
 
 #include "lgmalloc_features.h"
+#include "lgmalloc_config.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
+/* Also spelled out in api/lgmalloc.h, the public
+ * `lgmalloc` macro emits its entries there too */
 #define LGMALLOC_HEURISTICS_SECTION ".lgmalloc_heuristics_data"
 
 /*
@@ -111,4 +115,77 @@ typedef struct
 			);										\
 	}	while (0)
 
+/*
+ * What the entries of every loaded object add up to,
+ * collected once by `heuristics_collect` at init.
+ * 
+ * Constant sizes are kept sorted with the number of
+ * call sites requesting them and how often those were
+ * called so far. Runtime sized call sites only tell
+ * how many there are and how often they were called.
+ * 
+ * Frequencies are counted per thread, the ones here
+ * are those of the thread that initialized lgmalloc.
+ */
+typedef struct
+{
+	size_t	size;
+	size_t	sites;
+	size_t	freq;
+}	lgmalloc_heuristic_size_t;
+
+typedef struct
+{
+	lgmalloc_heuristic_size_t	sizes[LGMALLOC_HEURISTICS_MAX_SIZES];
+	size_t						size_count;
+	size_t						dropped_sites;
+	size_t						runtime_sites;
+	size_t						runtime_freq;
+}	lgmalloc_heuristics_t;
+
+COLD_CALL NO_INLINE
+void heuristics_collect(void);
+
+PURE
+const lgmalloc_heuristics_t *heuristics_get(void);
+
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heuristics_snapshot(lgmalloc_heuristics_t *out);
+
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heuristics_fold(lgmalloc_heuristics_t *RESTRICT h, const lgmalloc_heuristics_t *RESTRICT other);
+
+COLD_CALL NO_INLINE NO_NULL_ARGS
+void heuristics_merge(const lgmalloc_heuristics_t *other);
+
+/*
+ * Header of a persisted allocation profile, see
+ * profiling.c. Followed by `size_count` constant
+ * sizes and `class_count` size class records, both
+ * sorted by size. Profiles from builds with another
+ * layout are told apart by the magic and the entry
+ * sizes, and ignored.
+ */
+#define LGMALLOC_PROFILE_MAGIC		0x504D474CU	/* "LGMP" */
+#define LGMALLOC_PROFILE_VERSION	1U
+
+typedef struct
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	size_entry_size;
+	uint32_t	class_entry_size;
+	size_t		size_count;
+	size_t		class_count;
+	size_t		runtime_sites;
+	size_t		runtime_freq;
+}	lgmalloc_profile_header_t;
+
+/* Chunks the heaps of a run needed of one class at most */
+typedef struct
+{
+	size_t	block_size;
+	size_t	chunks;
+}	lgmalloc_profile_class_t;
+
 #endif /* __LGMALLOC_HEURISTICS_H */
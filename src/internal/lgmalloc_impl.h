@@ -15,15 +15,97 @@ void do_debug_tests(void);
 NO_INLINE COLD_CALL FLATTEN
 void init_prof_system(void);
 
+/* Persisted profile, see profiling.c */
+
+COLD_CALL
+void	prof_record_chunks(size_t class, size_t block_size, size_t chunks);
+COLD_CALL
+size_t	prof_warm_chunks(size_t block_size);
+COLD_CALL
+void	prof_thread_attach(void);
+
 void lgmalloc_init(void);
 void lgmalloc_reinit(void);
 int	 lgmalloc_is_init(void);
 
+/* Thread context, see heap.c */
+
+heap_t		*get_current_thread_heap(void);
+uintptr_t	lgmalloc_get_tid(void);
+
+/* Heap backend */
+
+COLD_CALL NO_INLINE
+heap_t	*heap_create(void);
+COLD_CALL NO_INLINE
+heap_t	*heap_acquire(void);
+COLD_CALL NO_INLINE
+void	heap_destroy(heap_t *heap);
+void	*heap_alloc(heap_t *heap, size_t size);
+void	*heap_alloc_class(heap_t *heap, size_t class, size_t size);
+void	*heap_alloc_aligned(heap_t *heap, size_t size, size_t alignment);
+void	heap_free(void *ptr);
+void	heap_free_sized(void *ptr, size_t size);
+size_t	heap_alloc_batch(heap_t *heap, size_t size, size_t count, void **out);
+void	heap_free_batch(void **ptrs, size_t count);
+size_t	heap_usable_size(const void *ptr);
+size_t	heap_good_size(size_t size);
+int		heap_fits_in_place(const void *ptr, size_t size);
+COLD_CALL NO_INLINE
+int		heap_trim(heap_t *heap);
+COLD_CALL
+size_t	heap_chunk_span(size_t class);
+void	*heap_remap(void *ptr, size_t size);
+
+/* Regions */
+
+COLD_CALL NO_INLINE
+region_t	*region_create(void);
+void		*region_alloc(region_t *region, size_t size);
+void		region_reset(region_t *region);
+void		region_release(region_t *region);
+void		region_destroy(region_t *region);
+
 /* Wrappers for internal usage */
 
 void	*__lgmalloc_wrapper(size_t size);
+void	*__lgmalloc_class_wrapper(size_t class, size_t size);
 void	__lgfree_wrapper(void *ptr);
+void	__lgfree_sized_wrapper(void *ptr, size_t size);
 void	*__lgcalloc_wrapper(size_t nmemb, size_t size);
 void	*__lgrealloc_wrapper(void *ptr, size_t size);
+void	*__lgreallocarray_wrapper(void *ptr, size_t nmemb, size_t size);
+void	*__lgmemalign_wrapper(size_t alignment, size_t size);
+void	*__lgaligned_alloc_wrapper(size_t alignment, size_t size);
+void	*__lgvalloc_wrapper(size_t size);
+void	*__lgpvalloc_wrapper(size_t size);
+size_t	__lgmalloc_batch_wrapper(size_t size, size_t count, void **out);
+void	__lgfree_batch_wrapper(void **ptrs, size_t count);
+heap_t	*__lgheap_create_wrapper(void);
+void	*__lgheap_malloc_wrapper(heap_t *heap, size_t size);
+void	__lgheap_free_wrapper(heap_t *heap, void *ptr);
+void	__lgheap_destroy_wrapper(heap_t *heap);
+region_t	*__lgregion_create_wrapper(void);
+void	*__lgregion_alloc_wrapper(region_t *region, size_t size);
+void	__lgregion_reset_wrapper(region_t *region);
+void	__lgregion_release_wrapper(region_t *region);
+void	__lgregion_destroy_wrapper(region_t *region);
+size_t	__lgmalloc_usable_size_wrapper(void *ptr);
+size_t	__lgmalloc_good_size_wrapper(size_t size);
+int		__lgmalloc_trim_wrapper(size_t pad);
+int		__lgposix_memalign_wrapper(void **memptr, size_t alignment, size_t size);
+
+/* C++ operators, see lgcpp_operators.c */
+
+void	*__lgcpp_new_wrapper(size_t size);
+void	*__lgcpp_new_nothrow_wrapper(size_t size, const void *tag);
+void	*__lgcpp_new_aligned_wrapper(size_t size, size_t alignment);
+void	*__lgcpp_new_aligned_nothrow_wrapper(size_t size, size_t alignment, const void *tag);
+void	__lgcpp_delete_wrapper(void *ptr);
+void	__lgcpp_delete_nothrow_wrapper(void *ptr, const void *tag);
+void	__lgcpp_delete_sized_wrapper(void *ptr, size_t size);
+void	__lgcpp_delete_aligned_wrapper(void *ptr, size_t alignment);
+void	__lgcpp_delete_aligned_nothrow_wrapper(void *ptr, size_t alignment, const void *tag);
+void	__lgcpp_delete_sized_aligned_wrapper(void *ptr, size_t size, size_t alignment);
 
 #endif /* __LGMALLOC_IMPL_H */
@@ -0,0 +1,183 @@
+/* ******************************************** */
+/*                                              */
+/*   lgmalloc_rseq.h                            */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+/* Restartable sequences, per-CPU bins without atomics.
+ *
+ * Each operation is a short critical section the kernel
+ * restarts at its abort handler whenever the thread is
+ * preempted, migrated or interrupted by a signal before
+ * the single committing store. So a bin indexed by the
+ * current CPU is only ever modified by one thread at
+ * a time, as long as the CPU didn't change in between.
+ *
+ * We don't register the area ourselves, glibc does for
+ * every thread since 2.35. If it didn't, `__rseq_size`
+ * is 0 and the per-CPU mode stays off.
+ *
+ * Only x86_64 Linux for now.
+ */
+
+#ifndef __LGMALLOC_RSEQ_H
+#define __LGMALLOC_RSEQ_H
+
+#include "lgmalloc_features.h"
+#include "lgmalloc_types.h"
+
+#if defined(__linux__) && defined(__x86_64__) && __has_include(<sys/rseq.h>)
+#define LGMALLOC_HAVE_RSEQ
+#endif
+
+#if defined(LGMALLOC_HAVE_RSEQ)
+
+#include <sys/rseq.h>
+#include <stdint.h>
+
+#define __LGMALLOC_RSEQ_STR_(x)	#x
+#define __LGMALLOC_RSEQ_STR(x)	__LGMALLOC_RSEQ_STR_(x)
+
+/* Critical section descriptor, found by the kernel
+ * through the thread's `rseq_cs` field */
+#define __LGMALLOC_RSEQ_DEFINE_TABLE(label, start_ip, post_commit_ip, abort_ip)	\
+	".pushsection __rseq_cs, \"aw\"\n\t"											\
+	".balign 32\n\t"																\
+	__LGMALLOC_RSEQ_STR(label) ":\n\t"												\
+	".long 0x0, 0x0\n\t"															\
+	".quad " __LGMALLOC_RSEQ_STR(start_ip) ", "										\
+		"(" __LGMALLOC_RSEQ_STR(post_commit_ip) " - "								\
+		__LGMALLOC_RSEQ_STR(start_ip) "), "											\
+		__LGMALLOC_RSEQ_STR(abort_ip) "\n\t"										\
+	".popsection\n\t"
+
+#define __LGMALLOC_RSEQ_STORE_CS(label, cs_label)									\
+	"leaq " __LGMALLOC_RSEQ_STR(cs_label) "(%%rip), %%rax\n\t"						\
+	"movq %%rax, %[rseq_cs]\n\t"													\
+	__LGMALLOC_RSEQ_STR(label) ":\n\t"
+
+/* The abort handler must be preceded by the signature
+ * glibc registered with, encoded as `ud1` so that it
+ * disassembles sensibly */
+#define __LGMALLOC_RSEQ_DEFINE_ABORT(label, abort_label)							\
+	".pushsection __rseq_failure, \"ax\"\n\t"										\
+	".byte 0x0f, 0xb9, 0x3d\n\t"													\
+	".long " __LGMALLOC_RSEQ_STR(RSEQ_SIG) "\n\t"									\
+	__LGMALLOC_RSEQ_STR(label) ":\n\t"												\
+	"jmp %l[" __LGMALLOC_RSEQ_STR(abort_label) "]\n\t"								\
+	".popsection\n\t"
+
+static ALWAYS_INLINE PURE HOT_CALL
+struct rseq *rseq_current(void)
+{
+	return (struct rseq*)((uintptr_t)__builtin_thread_pointer() + (uintptr_t)__rseq_offset);
+}
+
+static ALWAYS_INLINE COLD_CALL
+int rseq_available(void)
+{
+	return __rseq_size != 0 &&
+		   (int32_t)rseq_current()->cpu_id >= 0;
+}
+
+/* CPU to index per-CPU data with. Only a hint, the
+ * operations below verify it before committing. */
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+uint32_t rseq_cpu_start(const struct rseq *rs)
+{
+	return __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+}
+
+/* Pops the most recently pushed block of `bin` into `out`.
+ * Returns 1 on success, 0 when the bin is empty and -1
+ * when the thread isn't on `cpu` anymore, or the section
+ * was aborted, in which case the caller should retry. */
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+int rseq_bin_pop(
+	struct rseq *RESTRICT	rs,
+	uint32_t				cpu,
+	percpu_bin_t *RESTRICT	bin,
+	void **RESTRICT			out)
+{
+	__asm__ goto (
+		__LGMALLOC_RSEQ_DEFINE_TABLE(3, 1f, 2f, 4f)
+		__LGMALLOC_RSEQ_STORE_CS(1, 3b)
+		"cmpl %[cpu], %[cpu_id]\n\t"
+		"jnz 4f\n\t"
+		"movq %[count], %%rcx\n\t"
+		"testq %%rcx, %%rcx\n\t"
+		"jz %l[empty]\n\t"
+		"movq -8(%[slots], %%rcx, 8), %%rdx\n\t"
+		"movq %%rdx, (%[out])\n\t"
+		"decq %%rcx\n\t"
+		/* Commit */
+		"movq %%rcx, %[count]\n\t"
+		"2:\n\t"
+		__LGMALLOC_RSEQ_DEFINE_ABORT(4, abort)
+		:
+		: [cpu]		"r"(cpu),
+		  [cpu_id]	"m"(rs->cpu_id),
+		  [rseq_cs]	"m"(rs->rseq_cs),
+		  [count]	"m"(bin->count),
+		  [slots]	"r"(bin->slots),
+		  [out]		"r"(out)
+		: "memory", "cc", "rax", "rcx", "rdx"
+		: empty, abort
+	);
+
+	return 1;
+empty:
+	return 0;
+abort:
+	return -1;
+}
+
+/* Pushes `block` onto `bin` unless it already holds
+ * `capacity` blocks. Returns 1 on success, 0 when the
+ * bin is full and -1 when the caller should retry. */
+static ALWAYS_INLINE HOT_CALL NO_NULL_ARGS
+int rseq_bin_push(
+	struct rseq *RESTRICT	rs,
+	uint32_t				cpu,
+	percpu_bin_t *RESTRICT	bin,
+	void					*block,
+	size_t					capacity)
+{
+	__asm__ goto (
+		__LGMALLOC_RSEQ_DEFINE_TABLE(3, 1f, 2f, 4f)
+		__LGMALLOC_RSEQ_STORE_CS(1, 3b)
+		"cmpl %[cpu], %[cpu_id]\n\t"
+		"jnz 4f\n\t"
+		"movq %[count], %%rcx\n\t"
+		"cmpq %[capacity], %%rcx\n\t"
+		"jae %l[full]\n\t"
+		"movq %[block], (%[slots], %%rcx, 8)\n\t"
+		"incq %%rcx\n\t"
+		/* Commit */
+		"movq %%rcx, %[count]\n\t"
+		"2:\n\t"
+		__LGMALLOC_RSEQ_DEFINE_ABORT(4, abort)
+		:
+		: [cpu]			"r"(cpu),
+		  [cpu_id]		"m"(rs->cpu_id),
+		  [rseq_cs]		"m"(rs->rseq_cs),
+		  [count]		"m"(bin->count),
+		  [slots]		"r"(bin->slots),
+		  [block]		"r"(block),
+		  [capacity]	"r"(capacity)
+		: "memory", "cc", "rax", "rcx"
+		: full, abort
+	);
+
+	return 1;
+full:
+	return 0;
+abort:
+	return -1;
+}
+
+#endif /* LGMALLOC_HAVE_RSEQ */
+
+#endif /* __LGMALLOC_RSEQ_H */
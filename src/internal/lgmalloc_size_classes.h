@@ -12,12 +12,14 @@
 #include "lgmalloc_features.h"
 #include "lgmalloc_config.h"
 #include "lgmalloc_types.h"
+#include "lgmalloc_heuristics.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
 /* Implementations are all in header file
- * due to inlining and thread locality */
+ * due to inlining, the classes in use are
+ * built by init.c once for the process */
 
 /* Size class abstraction
  * for memory blocks */
@@ -39,10 +41,29 @@ GUARANTEE(
 
 #define LGMALLOC_SMALL_GRANULARITY			16
 
+/* Blocks are laid out right after the chunk header,
+ * so `chunk_t` only has to fit within it, while a
+ * free block has to be able to hold its own link */
+GUARANTEE(
+	LGMALLOC_CHUNK_T_SIZE <= LGMALLOC_CHUNK_HEADER_SIZE,
+	"chunk_t does not fit within the chunk header"
+);
+GUARANTEE(
+	LGMALLOC_BLOCK_T_SIZE <= LGMALLOC_SMALL_GRANULARITY,
+	"block_t does not fit within the smallest size class"
+);
+
 #define LGMALLOC_SMALL_CHUNK_SIZE_SHIFT		16
 #define LGMALLOC_SMALL_CHUNK_SIZE			(1 << LGMALLOC_SMALL_CHUNK_SIZE_SHIFT)
 #define LGMALLOC_SMALL_CHUNK_MASK			(~((uintptr_t)LGMALLOC_SMALL_CHUNK_SIZE - 1))
 
+/* The first slices of every segment hold the segment
+ * structure, followed by the heap structure for the
+ * segment that hosts it. Chunks are carved after. */
+#define LGMALLOC_SEGMENT_META_SIZE							\
+	ALIGN_UP(LGMALLOC_SEGMENT_T_SIZE + LGMALLOC_HEAP_T_SIZE,	\
+			 LGMALLOC_SMALL_CHUNK_SIZE)
+
 #define LGMALLOC_MEDIUM_CHUNK_SIZE_SHIFT	22
 #define LGMALLOC_MEDIUM_CHUNK_SIZE			(1 << LGMALLOC_MEDIUM_CHUNK_SIZE_SHIFT)
 #define LGMALLOC_MEDIUM_CHUNK_MASK			(~((uintptr_t)LGMALLOC_MEDIUM_CHUNK_SIZE - 1))
@@ -51,9 +72,19 @@ GUARANTEE(
 #define LGMALLOC_LARGE_CHUNK_SIZE			(1 << LGMALLOC_LARGE_CHUNK_SIZE_SHIFT)
 #define LGMALLOC_LARGE_CHUNK_MASK			(~((uintptr_t)LGMALLOC_LARGE_CHUNK_SIZE - 1))
 
-#define LGMALLOC_SEGMENT_SIZE				(256 * 1024 * 1024)
+#define LGMALLOC_SEGMENT_SIZE_SHIFT			28
+#define LGMALLOC_SEGMENT_SIZE				(1 << LGMALLOC_SEGMENT_SIZE_SHIFT)
 #define LGMALLOC_SEGMENT_MASK				(~((uintptr_t)(LGMALLOC_SEGMENT_SIZE - 1)))
 
+GUARANTEE(
+	(LGMALLOC_SEGMENT_SIZE >> LGMALLOC_SMALL_CHUNK_SIZE_SHIFT) == LGMALLOC_SEGMENT_SLICES,
+	"LGMALLOC_SEGMENT_SLICES does not match the segment and chunk sizes"
+);
+GUARANTEE(
+	!(LGMALLOC_SEGMENT_SIZE % LGMALLOC_HUGE_PAGE_SIZE),
+	"segments must be made of whole huge pages"
+);
+
 #define LGMALLOC_SMALL_CLASS(n)			\
 {										\
 	(n * LGMALLOC_SMALL_GRANULARITY),	\
@@ -78,11 +109,12 @@ GUARANTEE(
 	(n * LGMALLOC_SMALL_GRANULARITY)	\
 }
 
-/* Default size classes which is then optimized
- * Will always be of size `size_class_count_g`
+/* Default size classes, the layout the size class
+ * formula in `get_size_class` computes indices for.
+ * The classes in use are derived from these once
+ * at init, see `size_classes_init`.
  */
-static _Thread_local TLS_MODEL
-size_class_t __size_classes_g[] =
+static const size_class_t __default_size_classes_g[] =
 {
 	LGMALLOC_SMALL_CLASS(1),		LGMALLOC_SMALL_CLASS(1),		LGMALLOC_SMALL_CLASS(2),
 	LGMALLOC_SMALL_CLASS(3),		LGMALLOC_SMALL_CLASS(4),		LGMALLOC_SMALL_CLASS(5),
@@ -125,85 +157,327 @@ size_class_t __size_classes_g[] =
 	LGMALLOC_LARGE_CLASS(393216),	LGMALLOC_LARGE_CLASS(458752),	LGMALLOC_LARGE_CLASS(524288)
 };
 
-static _Thread_local TLS_MODEL size_t __size_class_count_g
-	= sizeof(__size_classes_g) / sizeof(size_class_t);
+#define LGMALLOC_DEFAULT_SIZE_CLASS_COUNT	\
+	(sizeof(__default_size_classes_g) / sizeof(size_class_t))
 
-/* Clears out size classes above the mmap threshold.
- *
- * This is possible to do at compile time, however,
- * due to the nature of C's preprocessing this would
- * become highly unmaintainable and unscalable.
- * 
- * Therefore this is done at runtime in
- * one function, the performance overhead
- * is neglegiable and the benefits of this
- * far outweigh the compile-time benefits.
- * 
- * This function is also highly unsafe
- * and requires special attention.
- */
+GUARANTEE(
+	LGMALLOC_DEFAULT_SIZE_CLASS_COUNT <= LGMALLOC_SIZE_CLASS_MAX,
+	"size class array exceeds LGMALLOC_SIZE_CLASS_MAX"
+);
+GUARANTEE(
+	LGMALLOC_SIZE_CLASS_MAX <= UINT8_MAX + 1,
+	"size class indices must fit the remap table"
+);
+
+/* Exact-fit classes the heuristics may split
+ * off one default class, bounding the lookup */
+#define LGMALLOC_SIZE_CLASS_SPLITS	2
+
+/* Classes in use, their count, and the first class in
+ * use for every default class below the threshold.
+ * Without heuristics this is the identity. Defined in
+ * init.c and only ever read once built. */
+extern size_class_t	__size_classes_g[LGMALLOC_SIZE_CLASS_MAX];
+extern size_t		__size_class_count_g;
+extern uint8_t		__size_class_remap_g[LGMALLOC_DEFAULT_SIZE_CLASS_COUNT];
+extern size_t		__default_size_class_count_g;
+
+/* Builds the classes in use, the first call does */
+COLD_CALL NO_INLINE
+void size_classes_init(void);
+
+/* Default class for `size` in constant time, or 0 when
+ * the default layout can't hold it. Only valid above
+ * the granularity classes, which map one to one. The
+ * `lgmalloc` macro in api/lgmalloc.h has a constant
+ * expression twin of it, both have to agree. */
+static ALWAYS_INLINE HOT_CALL
+size_t __default_size_class(size_t size)
+{
+	/* To clarify this convoluted and unsafe mess:
+	 *
+	 * We calculate the minimum block count, rounded up.
+	 * Since sizes up to 64 times the minimum granularity
+	 * never get here, the minimum block count is now
+	 * guaranteed to be larger than 64, we use bit
+	 * manipulation and calculate the position of the
+	 * most significant bit, which is guaranteed to be
+	 * larger or equal to 6, this is explicitly optimized away.
+	 * 
+	 * Class sizes are then in the format `[...]000xxx000[...]`
+	 * where we already have the position of the most significant
+	 * bit, so then we can calculate the subclass from the
+	 * remaining two bits.
+	 * 
+	 * Finally, we verify the bounds, the size class can hold
+	 * the requested size and that we're not over-allocating.
+	 */
+
+	const size_t min_blk_cnt = (size + LGMALLOC_SMALL_GRANULARITY - 1)
+									 / LGMALLOC_SMALL_GRANULARITY;
+
+	const size_t search_val = min_blk_cnt - 1;
+
+#if LGMALLOC_64_BIT
+	const size_t most_sig_bit = (size_t)(63 - __builtin_clzl(search_val));
+#else
+	const size_t most_sig_bit = (size_t)(31 - __builtin_clz((unsigned int)search_val));
+#endif
+
+	/* INVARIANT: mathematically guaranteed most_sig_bit >= 6
+	 * Proof: size > GRANULARITY*64 → min_blk_cnt >= 65 → search_val >= 64
+	 * → most_sig_bit >= 6 (since 64 requires 7 bits, MSB at position 6) */
+	ASSUME(most_sig_bit >= 6);
+
+	const size_t cls = ((most_sig_bit << 2)  +
+		((search_val >> (most_sig_bit -  2)) & 0x03)) + 41;
+
+	if (UNLIKELY((cls >= __default_size_class_count_g)						||
+				 (__default_size_classes_g[cls].block_sz < size)			||
+				 (cls && __default_size_classes_g[cls - 1].block_sz >= size)))
+		return 0;
+
+	return cls;
+}
+
+/* First class in use at or above `size`, starting from
+ * its default class. Classes must already be built. */
+static ALWAYS_INLINE HOT_CALL
+size_t __remap_size_class(size_t cls, size_t size)
+{
+	size_t class = __size_class_remap_g[cls];
+
+	while (__size_classes_g[class].block_sz < size)
+		++class;
+
+	return class;
+}
+
+/* Bytes of the chunks the default layout uses for
+ * blocks of this size, split off classes keep them */
+static ALWAYS_INLINE CONST_CALL
+size_t __size_class_chunk_size(size_t block_sz)
+{
+	if (block_sz <= LGMALLOC_SMALL_GRANULARITY * 256)
+		return LGMALLOC_SMALL_CHUNK_SIZE;
+
+	if (block_sz <= LGMALLOC_SMALL_GRANULARITY * 16384)
+		return LGMALLOC_MEDIUM_CHUNK_SIZE;
+
+	return LGMALLOC_LARGE_CHUNK_SIZE;
+}
+
+static ALWAYS_INLINE CONST_CALL
+size_t __size_class_block_cnt(size_t block_sz, size_t chunk_size)
+{
+	const size_t count = (chunk_size - LGMALLOC_CHUNK_HEADER_SIZE) / block_sz;
+	return count ? count : 1;
+}
+
+/* Copies the default classes below the mmap threshold */
 static COLD_CALL inline
 void __clean_size_classes(void)
 {
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wpointer-arith"
-	/* write, read, end ptrs */
-	size_class_t *wrp		= __size_classes_g;
-	size_class_t *rdp		= __size_classes_g;
-	size_class_t *const edp	= __size_classes_g +
-							  __size_class_count_g;
-
-	for (; rdp < edp; ++rdp)
-		if (rdp->block_sz >= LGMALLOC_MMAP_THRESHOLD)
-			if (wrp++ != rdp)
-				*(wrp - 1) = *rdp;
-
-	__size_class_count_g = wrp - __size_classes_g;
-
-#if __has_builtin(__builtin_memset_inline)
-	/* Avoid the loop if inline memset exists */
-	const size_t bytes = (edp - wrp);
-	if (bytes)
-		__builtin_memset_inline(
-			wrp, 0, bytes *
-			sizeof(size_class_t)
-		);
-#else
-	for (; wrp < edp; ++wrp)
-		memset_constexpr(
-			wrp, 0, sizeof(size_class_t)
-		);
-#endif /* __has_builtin(__builtin_memset_inline) */
-#pragma clang diagnostic pop
+	size_t count = 0;
+
+	for (size_t i = 0; i < LGMALLOC_DEFAULT_SIZE_CLASS_COUNT; ++i)
+		if (__default_size_classes_g[i].block_sz < LGMALLOC_MMAP_THRESHOLD)
+		{
+			__size_classes_g[count]		= __default_size_classes_g[i];
+			__size_class_remap_g[count]	= (uint8_t)count;
+			++count;
+		}
+
+	__size_class_count_g			= count;
+	__default_size_class_count_g	= count;
+}
+
+typedef struct
+{
+	size_t	size;
+	size_t	weight;
+	size_t	bucket;
+}	__size_class_candidate_t;
+
+/* What the heuristics predict for a class, the call
+ * sites asking for it plus how often they were called */
+static ALWAYS_INLINE PURE
+size_t __size_class_weight(const lgmalloc_heuristic_size_t *size)
+{
+	return size->sites + size->freq;
 }
 
-/* Initializes the size class array.
+/* Class in use for `size` while the remap table is
+ * already rebuilt, same as `get_size_class` does */
+static ALWAYS_INLINE HOT_CALL
+size_t __remapped_size_class(size_t size)
+{
+	if (size <= LGMALLOC_SMALL_GRANULARITY * 64)
+		return (size + LGMALLOC_SMALL_GRANULARITY - 1)
+					 / LGMALLOC_SMALL_GRANULARITY;
+
+	const size_t cls = __default_size_class(size);
+
+	if (UNLIKELY(!cls))
+		return 0;
+
+	return __remap_size_class(cls, size);
+}
+
+/* Applies the startup heuristics.
  *
- * Removes classes above the mmap threshold.
- * Applies heuristics to better determine
- * the exact classes.
+ * Hot constant sizes above the granularity classes that
+ * no default class fits exactly get a class of their own,
+ * the hottest first, while there's room and at most
+ * LGMALLOC_SIZE_CLASS_SPLITS per default class. The
+ * granularity classes already fit every size exactly
+ * up to alignment and keep their indices, so the tiny
+ * path's direct indexing stays valid.
+ * 
+ * Then block counts follow the predicted weight, twice
+ * the average doubles a class's chunks, under half of
+ * it halves them. Only tracked call sites are counted,
+ * plain malloc, preloaded callers and operator new all
+ * go unseen. So classes none of them reach keep their
+ * default chunks, and the granularity classes, where
+ * most of the unseen requests land, only ever grow.
+ * 
+ * Runs once for the process at init, after the
+ * heuristics and any persisted profile are in.
  */
-static FLATTEN
-size_class_t *__build_size_classes(void)
+static COLD_CALL inline
+void __apply_size_class_heuristics(void)
 {
-	static int initialized = 0;
-	
-	if (LIKELY(!initialized))
+	const lgmalloc_heuristics_t *h = heuristics_get();
+
+	if (!h->size_count)
+		return;
+
+	__size_class_candidate_t candidates[LGMALLOC_HEURISTICS_MAX_SIZES];
+	size_t candidate_count = 0;
+
+	for (size_t i = 0; i < h->size_count; ++i)
 	{
-		__clean_size_classes();
-		
-		/* TODO: Apply heuristics.
-		 *
-		 * Consider that array length might
-		 * need to change to accomodate this.
-		 * 
-		 * Therefore, a mmap call is possible.
-		 */
-		
-		initialized = 1;
+		const size_t size = ALIGN_UP(h->sizes[i].size, LGMALLOC_SMALL_GRANULARITY);
+
+		if (size <= LGMALLOC_SMALL_GRANULARITY * 64)
+			continue;
+
+		if (size >= LGMALLOC_MMAP_THRESHOLD)
+			break;
+
+		const size_t bucket = __default_size_class(size);
+
+		if (!bucket || __default_size_classes_g[bucket].block_sz == size)
+			continue;
+
+		/* Several sizes can round to the same class */
+		if (candidate_count && candidates[candidate_count - 1].size == size)
+		{
+			candidates[candidate_count - 1].weight += __size_class_weight(h->sizes + i);
+			continue;
+		}
+
+		candidates[candidate_count++] = (__size_class_candidate_t){
+			.size = size, .weight = __size_class_weight(h->sizes + i), .bucket = bucket
+		};
 	}
 
-	return __size_classes_g;
+	/* Keep the hottest, by weight */
+	for (size_t i = 1; i < candidate_count; ++i)
+	{
+		const __size_class_candidate_t candidate = candidates[i];
+		size_t j = i;
+
+		for (; j && candidates[j - 1].weight < candidate.weight; --j)
+			candidates[j] = candidates[j - 1];
+
+		candidates[j] = candidate;
+	}
+
+	uint8_t splits[LGMALLOC_DEFAULT_SIZE_CLASS_COUNT] = {0};
+	size_t  room	= LGMALLOC_SIZE_CLASS_MAX - __size_class_count_g;
+	size_t  kept	= 0;
+
+	for (size_t i = 0; i < candidate_count && kept < room; ++i)
+		if (splits[candidates[i].bucket] < LGMALLOC_SIZE_CLASS_SPLITS)
+		{
+			++splits[candidates[i].bucket];
+			candidates[kept++] = candidates[i];
+		}
+
+	/* Back in size order for the merge */
+	for (size_t i = 1; i < kept; ++i)
+	{
+		const __size_class_candidate_t candidate = candidates[i];
+		size_t j = i;
+
+		for (; j && candidates[j - 1].size > candidate.size; --j)
+			candidates[j] = candidates[j - 1];
+
+		candidates[j] = candidate;
+	}
+
+	/* Merge from the back, so the defaults can be
+	 * moved up in place as the splits slot in */
+	size_t write	= __size_class_count_g + kept;
+	size_t next		= kept;
+
+	for (size_t read = __size_class_count_g; read--; )
+	{
+		__size_classes_g[--write] = __default_size_classes_g[read];
+
+		for (; next && candidates[next - 1].bucket == read; --next)
+		{
+			const size_t size = candidates[next - 1].size;
+
+			__size_classes_g[--write] = (size_class_t){
+				size, __size_class_block_cnt(size, __size_class_chunk_size(size))
+			};
+		}
+
+		__size_class_remap_g[read] = (uint8_t)write;
+	}
+
+	__size_class_count_g += kept;
+
+	/* Scale the chunks by the predicted weight */
+	size_t weights[LGMALLOC_SIZE_CLASS_MAX] = {0};
+	size_t total	= 0;
+	size_t reached	= 0;
+
+	for (size_t i = 0; i < h->size_count; ++i)
+	{
+		if (h->sizes[i].size >= LGMALLOC_MMAP_THRESHOLD)
+			break;
+
+		const size_t class = __remapped_size_class(h->sizes[i].size);
+
+		if (UNLIKELY(!class || class >= __size_class_count_g))
+			continue;
+
+		reached	+= !weights[class];
+		weights[class] += __size_class_weight(h->sizes + i);
+		total	+= __size_class_weight(h->sizes + i);
+	}
+
+	for (size_t class = 1; reached && class < __size_class_count_g; ++class)
+	{
+		size_class_t *sc = __size_classes_g + class;
+
+		const size_t min_cnt = __size_class_block_cnt(sc->block_sz, LGMALLOC_SMALL_CHUNK_SIZE);
+		const size_t max_cnt = __size_class_block_cnt(sc->block_sz, LGMALLOC_LARGE_CHUNK_SIZE);
+
+		if (!weights[class])
+			continue;
+
+		/* weight against the average weight, total / reached */
+		if (weights[class] * reached >= 2 * total)
+			sc->block_cnt = sc->block_cnt * 2 < max_cnt ? sc->block_cnt * 2 : max_cnt;
+		else if (weights[class] * reached * 2 < total &&
+				 sc->block_sz > LGMALLOC_SMALL_GRANULARITY * 64)
+			sc->block_cnt = sc->block_cnt / 2 > min_cnt ? sc->block_cnt / 2 : min_cnt;
+	}
 }
 
 /*
@@ -213,18 +487,19 @@ size_class_t *__build_size_classes(void)
 static ALWAYS_INLINE FLATTEN
 size_t get_size_class_count(void)
 {
+	LGMALLOC_ASSERT(__size_class_count_g, "size classes are built at init");
 	return __size_class_count_g;
 }
 
 /* Get the size class array.
  *
- * Will always return initialized
- * and optimized size classes.
+ * Classes are built at init, this
+ * returns the optimized size classes.
  */
 static ALWAYS_INLINE FLATTEN
 size_class_t *get_size_classes(void)
 {
-	__build_size_classes();
+	LGMALLOC_ASSERT(__size_class_count_g, "size classes are built at init");
 	return __size_classes_g;
 }
 
@@ -237,31 +512,20 @@ size_class_t *get_size_classes(void)
 static HOT_CALL inline
 size_t get_size_class(size_t size)
 {
-	/* To clarify this convoluted and unsafe mess:
-	 *
-	 * The `malloc(0)` edge case should already
-	 * be handled earlier in the call stack,
-	 * but in-case it's not, we return early.
+	/* The `malloc(0)` edge case should already be
+	 * handled earlier in the call stack, but in-case
+	 * it's not, we return early.
 	 * 
-	 * We then calculate the minimum block count, rounded up.
-	 * Then, for sizes up to 64 times the minimum granularity,
+	 * For sizes up to 64 times the minimum granularity,
 	 * the size class should already be predefined. Though,
 	 * for safety, we also need to check the appropriate
 	 * bounds and that the requested size can be held.
 	 * 
-	 * For larger allocations, we use bit manipulation.
-	 * We calculate the position of the most significant bit,
-	 * since the minimum block count is now guaranteed to be
-	 * larger than 64, this position is guaranteed to be
-	 * larger or equal to 6, this is explicitly optimized away.
-	 * 
-	 * Class sizes are then in the format `[...]000xxx000[...]`
-	 * where we already have the position of the most significant
-	 * bit, so then we can calculate the subclass from the
-	 * remaining two bits.
-	 * 
-	 * Finally, we verify the bounds, the size class can hold
-	 * the requested size and that we're not over-allocating.
+	 * Larger sizes find their default class by formula,
+	 * then the remap table gives the first class in use
+	 * from there. Only exact-fit classes split off by the
+	 * heuristics can sit in between, so the scan is
+	 * bounded by LGMALLOC_SIZE_CLASS_SPLITS.
 	 */
 
 	GUARANTEE(size, "Size must not be 0");
@@ -272,11 +536,11 @@ size_t get_size_class(size_t size)
 	if (UNLIKELY(!size_classes_count))
 		return size_classes_count;
 
-	const size_t min_blk_cnt = (size + LGMALLOC_SMALL_GRANULARITY - 1)
-									 / LGMALLOC_SMALL_GRANULARITY;
-
 	if (size <= (LGMALLOC_SMALL_GRANULARITY * 64))
 	{
+		const size_t min_blk_cnt = (size + LGMALLOC_SMALL_GRANULARITY - 1)
+										 / LGMALLOC_SMALL_GRANULARITY;
+
 		if (UNLIKELY(min_blk_cnt >= size_classes_count))
 			return 0;
 
@@ -286,28 +550,28 @@ size_t get_size_class(size_t size)
 		return min_blk_cnt;
 	}
 
-	const size_t search_val = min_blk_cnt - 1;
+	const size_t cls = __default_size_class(size);
 
-#if LGMALLOC_64_BIT
-	const size_t most_sig_bit = (size_t)(63 - __builtin_clzl(search_val));
-#else
-	const size_t most_sig_bit = (size_t)(31 - __builtin_clz((unsigned int)search_val));
-#endif
+	if (UNLIKELY(!cls))
+		return 0;
 
-	/* INVARIANT: mathematically guaranteed most_sig_bit >= 6
-	 * Proof: size > GRANULARITY*64 → min_blk_cnt >= 65 → search_val >= 64
-	 * → most_sig_bit >= 6 (since 64 requires 7 bits, MSB at position 6) */
-	ASSUME(most_sig_bit >= 6);
+	return __remap_size_class(cls, size);
+}
 
-	const size_t cls = ((most_sig_bit << 2)  +
-		((search_val >> (most_sig_bit -  2)) & 0x03)) + 41;
+/* Class in use for a call site whose default class
+ * `cls` was resolved at compile time, only the split
+ * off classes the heuristics added are left to skip.
+ * 0 for the classes dropped below the threshold. */
+static ALWAYS_INLINE HOT_CALL
+size_t get_remapped_size_class(size_t cls, size_t size)
+{
+	if (size <= LGMALLOC_SMALL_GRANULARITY * 64)
+		return cls;
 
-	if (UNLIKELY((cls >= size_classes_count)			||
-				 (size_classes[cls].block_sz < size)	||
-				 (cls && size_classes[cls - 1].block_sz >= size)))
+	if (UNLIKELY(cls >= __default_size_class_count_g))
 		return 0;
 
-	return cls;
+	return __remap_size_class(cls, size);
 }
 
 #endif /* __LGMALLOC_SIZE_CLASSES_H */
@@ -9,17 +9,38 @@
 #ifndef __LGMALLOC_TYPES_H
 #define __LGMALLOC_TYPES_H
 
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
 typedef unsigned long int __attribute__((__may_alias__)) word_t;
 
+/* Upper bound on the size class array length,
+ * bins are indexed directly by size class. What
+ * the defaults leave is room for classes split
+ * off by the heuristics. */
+#define LGMALLOC_SIZE_CLASS_MAX	128
+
+/* Number of small chunk sized slices in a segment,
+ * the granularity at which pointers map to chunks */
+#define LGMALLOC_SEGMENT_SLICES	4096
+
+/* Freed dedicated mappings each heap keeps for reuse,
+ * binned by power of two page count from the threshold */
+#define LGMALLOC_MMAP_CACHE_BINS	8
+#define LGMALLOC_MMAP_CACHE_SLOTS	4
+
+/* Blocks a per-CPU bin can cache at most, sized
+ * so a bin fills exactly four cache lines */
+#define LGMALLOC_PERCPU_SLOTS	31
+
 /* Forward decls */
 typedef struct __block_t	block_t;
 typedef struct __chunk_t	chunk_t;
 typedef struct __segment_t	segment_t;
 typedef struct __mmap_t		mmap_t;
 typedef struct __heap_t		heap_t;
+typedef struct __region_t	region_t;
 
 /*
  * A raw memory block. It's the lowest abstraction
@@ -29,13 +50,17 @@ typedef struct __heap_t		heap_t;
  * Raw memory blocks are handled by chunks
  * which hold a linked list of memory blocks
  * all of the same size class (e.g. 8 bytes).
+ * 
+ * Blocks carry no header. A live block is pure
+ * user memory, its size is recovered from the
+ * owning chunk. A free block reuses its own
+ * payload to hold the free list link, which
+ * is why the smallest size class must be
+ * able to hold a `block_t`.
  */
 typedef struct __block_t
 {
 	struct __block_t	*next;
-	uintptr_t			alloc;
-	/* Remove size field later if not needed */
-	size_t				size;
 }	block_t;
 
 /*
@@ -52,16 +77,40 @@ typedef struct __block_t
  * Therefore a segment will have chunks
  * containing blocks of e.g. 8, 16, 32 etc.
  * 
+ * Blocks are handed out from `frontier` until it
+ * reaches the end of the chunk, only blocks that
+ * were freed go onto `free_list`. So a chunk only
+ * ever touches the pages it has actually used.
+ * 
+ * Chunks with at least one free block are linked
+ * through `next` and `prev` into their heap's bin
+ * for the chunk's size class. Full chunks are
+ * unlinked and only rejoin once a block is freed.
+ * 
+ * Empty chunks wait on their heap's purge queue,
+ * linked through `purge_next` and `purge_prev`,
+ * until their pages are handed back lazily. Then
+ * they move to their class's purged bin through
+ * the same links until they are used again.
+ * 
  * aka. page
  */
 typedef struct __chunk_t
 {
 	struct __chunk_t	*next;
 	struct __chunk_t	*prev;
+	block_t				*free_list;
+	uintptr_t			frontier;
 	size_t				size_class;
+	size_t				block_size;
 	size_t				block_count;
 	size_t				blocks_in_use;
 	int					is_full;
+	int					is_queued;
+	int					is_purged;
+	uint64_t			empty_since;
+	struct __chunk_t	*purge_next;
+	struct __chunk_t	*purge_prev;
 	segment_t			*parent_segment;
 }	chunk_t;
 
@@ -79,30 +128,49 @@ typedef struct __chunk_t
  * predictable allocations. This also optimizes
  * handling over larger memory areas for the user.
  * 
+ * Chunks are carved in order from the start of the
+ * segment, `chunk_top` is the offset of the next one.
+ * Every slice a chunk spans points back to it from
+ * `chunk_map`, so any pointer into the segment finds
+ * its chunk with a mask, a shift and one load.
+ * 
  * aka. arena, span, etc
  */
 typedef struct __segment_t
 {
 	struct __segment_t	*next;
-	heap_t				*parent_heap;
-	chunk_t				*chunk_list;
+	heap_t *_Atomic		parent_heap;
+	size_t				chunk_top;
 	size_t				chunk_count;
 	size_t				segment_size;
 	uintptr_t			mmap_start;
+	chunk_t				*chunk_map[LGMALLOC_SEGMENT_SLICES];
 }	segment_t;
 
 /*
  * Linked list holding all dedicated memory mappings.
  * This helps simplify freeing process, since
  * calling free on this will directly go to `munmap`
+ * 
+ * The structure sits right in front of the memory
+ * handed to the user, so freeing finds it with a
+ * single subtraction and the doubly linked list
+ * lets it unlink in constant time. The cookie
+ * catches foreign pointers in debug builds.
  */
 typedef struct __mmap_t
 {
 	struct __mmap_t	*next;
+	struct __mmap_t	*prev;
 	void			*alloc;
 	size_t			size;
+	heap_t			*parent_heap;
+	uintptr_t		cookie;
 }	mmap_t;
 
+#define LGMALLOC_MMAP_COOKIE(map) \
+	((uintptr_t)(map) ^ (uintptr_t)0x6c676d616c6c6f63ULL)
+
 /* 
  * Thread-unique structure holding all heap data 
  * This avoids atomic & locking overhead and
@@ -112,30 +180,115 @@ typedef struct __mmap_t
  * the memory footprint won't scale like it
  * does in tcmalloc which has a centralized
  * list handling method for all threads.
+ * 
+ * The one exception is `thread_free`. Memory freed
+ * by a thread that doesn't own the heap is pushed
+ * onto it without locking, using the freed memory
+ * itself as the link. The owner drains it in one
+ * batch whenever it has to take the slow path.
+ * 
+ * Dedicated mappings freed by the owner are kept in
+ * `mmap_cache` for a while, so codecs and buffers
+ * churning through large allocations don't pay for
+ * an munmap and an mmap every single time.
+ * 
+ * Empty chunks wait on the purge queue until their
+ * pages decayed, then on `purged_bins` until they're
+ * needed again. With background purging enabled
+ * both are shared with the purge thread and guarded
+ * by `purge_lock`, only ever taken on the slow paths
+ * of the owner.
+ * 
+ * When its thread exits a heap is abandoned, `tid`
+ * becomes 0 and the heap waits in a process wide
+ * pool until a new thread adopts it whole, or until
+ * another heap reclaims one of its segments.
  */
+typedef struct __mmap_cache_entry_t
+{
+	mmap_t		*map;
+	uint64_t	stamp;
+}	mmap_cache_entry_t;
+
 typedef struct __heap_t
 {
-	uintptr_t		tid;
+	_Atomic uintptr_t	tid;
 	segment_t		*segment_list;
 	size_t			segment_count;
 	mmap_t			*mmap_list;
 	size_t			mmap_count;
+	size_t			mmap_cache_count;
+	size_t			mmap_cache_bytes;
+	mmap_cache_entry_t	mmap_cache[LGMALLOC_MMAP_CACHE_BINS]
+							  [LGMALLOC_MMAP_CACHE_SLOTS];
+	block_t *_Atomic	thread_free;
+	struct __heap_t	*next_abandoned;
+	size_t			segments_donated;
+	chunk_t			*purge_head;
+	chunk_t			*purge_tail;
+	atomic_flag		purge_lock;
+	int				numa_node;
+	struct __heap_t	*next_registered;
+	chunk_t			*chunk_bins[LGMALLOC_SIZE_CLASS_MAX];
+	chunk_t			*purged_bins[LGMALLOC_SIZE_CLASS_MAX];
+#if defined(LGMALLOC_ENABLE_PROFILING)
+	size_t			chunks_carved[LGMALLOC_SIZE_CLASS_MAX];
+#endif
 }	heap_t;
 
+/*
+ * Per-CPU block cache for one size class, a plain
+ * stack. Only ever modified through restartable
+ * sequences by whichever thread runs on its CPU.
+ */
+typedef struct __percpu_bin_t
+{
+	size_t	count;
+	void	*slots[LGMALLOC_PERCPU_SLOTS];
+}	percpu_bin_t;
+
+typedef struct __percpu_cache_t
+{
+	percpu_bin_t	bins[LGMALLOC_SIZE_CLASS_MAX];
+}	percpu_cache_t;
+
+/*
+ * A memory mapping owned by a region, its header sits
+ * at the start of the mapping. Blocks of one region
+ * are linked in the order they are used in.
+ */
+typedef struct __region_block_t
+{
+	struct __region_block_t	*next;
+	size_t					size;
+}	region_block_t;
+
+/*
+ * A monotonic bump allocator. Memory is handed out from
+ * `cursor` up to `end` of the `current` block and never
+ * freed individually, only all at once by a reset.
+ * 
+ * The region lives in its first block, right after the
+ * block header. Blocks past `current` were used before
+ * the last reset and are taken again before mapping
+ * more, so a reset region settles on a fixed footprint.
+ */
+typedef struct __region_t
+{
+	region_block_t	*first;
+	region_block_t	*current;
+	uintptr_t		cursor;
+	uintptr_t		end;
+}	region_t;
+
 #define LGMALLOC_BLOCK_T_SIZE	sizeof(block_t)
 #define LGMALLOC_CHUNK_T_SIZE	sizeof(chunk_t)
 #define LGMALLOC_SEGMENT_T_SIZE	sizeof(segment_t)
 #define LGMALLOC_MMAP_T_SIZE	sizeof(mmap_t)
 #define LGMALLOC_HEAP_T_SIZE	sizeof(heap_t)
+#define LGMALLOC_REGION_BLOCK_T_SIZE	sizeof(region_block_t)
+#define LGMALLOC_REGION_T_SIZE			sizeof(region_t)
 
-GUARANTEE(
-	LGMALLOC_BLOCK_T_SIZE % sizeof(max_align_t) == 0,
-	"block_t size must preserve alignment"
-);
-GUARANTEE(
-	LGMALLOC_CHUNK_T_SIZE % sizeof(max_align_t) == 0,
-	"chunk_t size must preserve alignment"
-);
 GUARANTEE(
 	LGMALLOC_SEGMENT_T_SIZE % sizeof(max_align_t) == 0,
 	"segment_t size must preserve alignment"
@@ -148,5 +301,13 @@ GUARANTEE(
 	LGMALLOC_HEAP_T_SIZE % sizeof(max_align_t) == 0,
 	"heap_t size must preserve alignment"
 );
+GUARANTEE(
+	LGMALLOC_REGION_BLOCK_T_SIZE % sizeof(max_align_t) == 0,
+	"region_block_t size must preserve alignment"
+);
+GUARANTEE(
+	LGMALLOC_REGION_T_SIZE % sizeof(max_align_t) == 0,
+	"region_t size must preserve alignment"
+);
 
 #endif /* __LGMALLOC_TYPES_H */
@@ -0,0 +1,64 @@
+/* ******************************************** */
+/*                                              */
+/*   lgbatch.c                                  */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+#include <errno.h>
+
+static ALWAYS_INLINE HOT_CALL
+size_t __lgmalloc_batch_impl(size_t size, size_t count, void **out)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	if (UNLIKELY(!count || !out))
+		return 0;
+
+	if (UNLIKELY(size > LGMALLOC_MAX_ALLOC_SIZE))
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	/* Unique pointers, like lgmalloc(0) */
+	if (UNLIKELY(!size))
+		size = 1;
+
+	heap_t *heap = get_current_thread_heap();
+	GUARANTEE(heap, "heap must not be NULL");
+
+	return heap_alloc_batch(heap, size, count, out);
+}
+
+static ALWAYS_INLINE HOT_CALL
+void __lgfree_batch_impl(void **ptrs, size_t count)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	if (UNLIKELY(!count || !ptrs))
+		return;
+
+	heap_free_batch(ptrs, count);
+}
+
+size_t __lgmalloc_batch_wrapper(size_t size, size_t count, void **out)
+{
+	return __lgmalloc_batch_impl(size, count, out);
+}
+
+void __lgfree_batch_wrapper(void **ptrs, size_t count)
+{
+	__lgfree_batch_impl(ptrs, count);
+}
+
+EXTERN_STRONG_ALIAS(__lgmalloc_batch_wrapper, lgmalloc_batch);
+EXTERN_STRONG_ALIAS(__lgfree_batch_wrapper, lgfree_batch);
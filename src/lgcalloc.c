@@ -210,3 +210,6 @@ EXTERN_STRONG_ALIAS(lgcalloc, calloc);
 #if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
 EXTERN_WEAK_ALIAS(lgcalloc, calloc);
 #endif
+
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgcalloc_wrapper, __wrap_calloc);
@@ -0,0 +1,142 @@
+/* ******************************************** */
+/*                                              */
+/*   lgcpp_operators.c                          */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+/* The C++ allocation operators under their Itanium ABI
+ * names, so a preloaded library replaces them for C++
+ * programs that never include lgmalloc_cpp_operators.hpp.
+ * `std::align_val_t` is passed as a `size_t` and
+ * `std::nothrow_t const&` as a pointer.
+ * 
+ * Like the header, nothing here throws, a failed
+ * allocation returns NULL even without nothrow. */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+MALLOC_CALL(1)
+void *__lgcpp_new_wrapper(size_t size)
+{
+	return __lgmalloc_wrapper(size);
+}
+
+MALLOC_CALL(1)
+void *__lgcpp_new_nothrow_wrapper(size_t size, const void *tag)
+{
+	DISCARD_ARGS(tag);
+	return __lgmalloc_wrapper(size);
+}
+
+MALLOC_CALL(1)
+void *__lgcpp_new_aligned_wrapper(size_t size, size_t alignment)
+{
+	return __lgmemalign_wrapper(alignment, size);
+}
+
+MALLOC_CALL(1)
+void *__lgcpp_new_aligned_nothrow_wrapper(size_t size, size_t alignment, const void *tag)
+{
+	DISCARD_ARGS(tag);
+	return __lgmemalign_wrapper(alignment, size);
+}
+
+void __lgcpp_delete_wrapper(void *ptr)
+{
+	__lgfree_wrapper(ptr);
+}
+
+void __lgcpp_delete_nothrow_wrapper(void *ptr, const void *tag)
+{
+	DISCARD_ARGS(tag);
+	__lgfree_wrapper(ptr);
+}
+
+void __lgcpp_delete_sized_wrapper(void *ptr, size_t size)
+{
+	__lgfree_sized_wrapper(ptr, size);
+}
+
+/* Over-aligned allocations may sit in a dedicated mapping
+ * whatever their size, so the size can't tell where they
+ * live and they must not take the sized path. The block
+ * is found from the pointer alone, the alignment isn't
+ * needed either, a plain free covers all three. */
+void __lgcpp_delete_aligned_wrapper(void *ptr, size_t alignment)
+{
+	DISCARD_ARGS(alignment);
+	__lgfree_wrapper(ptr);
+}
+
+void __lgcpp_delete_aligned_nothrow_wrapper(void *ptr, size_t alignment, const void *tag)
+{
+	DISCARD_ARGS(alignment, tag);
+	__lgfree_wrapper(ptr);
+}
+
+void __lgcpp_delete_sized_aligned_wrapper(void *ptr, size_t size, size_t alignment)
+{
+	DISCARD_ARGS(size, alignment);
+	__lgfree_wrapper(ptr);
+}
+
+/* The names encode `size_t`, as `unsigned long` on LP64
+ * and as `unsigned int` on the 32 bit targets we run on */
+#if defined(__LP64__)
+#define __LGCPP_NAME(prefix, suffix)	prefix ## m ## suffix
+#else
+#define __LGCPP_NAME(prefix, suffix)	prefix ## j ## suffix
+#endif
+
+/* -DFORCE_LGMALLOC_REPLACE_STDLIB */
+#if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
+EXTERN_STRONG_ALIAS(__lgcpp_new_wrapper, __LGCPP_NAME(_Znw, ));
+EXTERN_STRONG_ALIAS(__lgcpp_new_wrapper, __LGCPP_NAME(_Zna, ));
+EXTERN_STRONG_ALIAS(__lgcpp_new_nothrow_wrapper, __LGCPP_NAME(_Znw, RKSt9nothrow_t));
+EXTERN_STRONG_ALIAS(__lgcpp_new_nothrow_wrapper, __LGCPP_NAME(_Zna, RKSt9nothrow_t));
+EXTERN_STRONG_ALIAS(__lgcpp_new_aligned_wrapper, __LGCPP_NAME(_Znw, St11align_val_t));
+EXTERN_STRONG_ALIAS(__lgcpp_new_aligned_wrapper, __LGCPP_NAME(_Zna, St11align_val_t));
+EXTERN_STRONG_ALIAS(__lgcpp_new_aligned_nothrow_wrapper, __LGCPP_NAME(_Znw, St11align_val_tRKSt9nothrow_t));
+EXTERN_STRONG_ALIAS(__lgcpp_new_aligned_nothrow_wrapper, __LGCPP_NAME(_Zna, St11align_val_tRKSt9nothrow_t));
+EXTERN_STRONG_ALIAS(__lgcpp_delete_wrapper, _ZdlPv);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_wrapper, _ZdaPv);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_nothrow_wrapper, _ZdlPvRKSt9nothrow_t);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_nothrow_wrapper, _ZdaPvRKSt9nothrow_t);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_sized_wrapper, __LGCPP_NAME(_ZdlPv, ));
+EXTERN_STRONG_ALIAS(__lgcpp_delete_sized_wrapper, __LGCPP_NAME(_ZdaPv, ));
+EXTERN_STRONG_ALIAS(__lgcpp_delete_aligned_wrapper, _ZdlPvSt11align_val_t);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_aligned_wrapper, _ZdaPvSt11align_val_t);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_aligned_nothrow_wrapper, _ZdlPvSt11align_val_tRKSt9nothrow_t);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_aligned_nothrow_wrapper, _ZdaPvSt11align_val_tRKSt9nothrow_t);
+EXTERN_STRONG_ALIAS(__lgcpp_delete_sized_aligned_wrapper, __LGCPP_NAME(_ZdlPv, St11align_val_t));
+EXTERN_STRONG_ALIAS(__lgcpp_delete_sized_aligned_wrapper, __LGCPP_NAME(_ZdaPv, St11align_val_t));
+#endif
+
+/* -DWEAK_LGMALLOC_REPLACE_STDLIB */
+#if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
+EXTERN_WEAK_ALIAS(__lgcpp_new_wrapper, __LGCPP_NAME(_Znw, ));
+EXTERN_WEAK_ALIAS(__lgcpp_new_wrapper, __LGCPP_NAME(_Zna, ));
+EXTERN_WEAK_ALIAS(__lgcpp_new_nothrow_wrapper, __LGCPP_NAME(_Znw, RKSt9nothrow_t));
+EXTERN_WEAK_ALIAS(__lgcpp_new_nothrow_wrapper, __LGCPP_NAME(_Zna, RKSt9nothrow_t));
+EXTERN_WEAK_ALIAS(__lgcpp_new_aligned_wrapper, __LGCPP_NAME(_Znw, St11align_val_t));
+EXTERN_WEAK_ALIAS(__lgcpp_new_aligned_wrapper, __LGCPP_NAME(_Zna, St11align_val_t));
+EXTERN_WEAK_ALIAS(__lgcpp_new_aligned_nothrow_wrapper, __LGCPP_NAME(_Znw, St11align_val_tRKSt9nothrow_t));
+EXTERN_WEAK_ALIAS(__lgcpp_new_aligned_nothrow_wrapper, __LGCPP_NAME(_Zna, St11align_val_tRKSt9nothrow_t));
+EXTERN_WEAK_ALIAS(__lgcpp_delete_wrapper, _ZdlPv);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_wrapper, _ZdaPv);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_nothrow_wrapper, _ZdlPvRKSt9nothrow_t);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_nothrow_wrapper, _ZdaPvRKSt9nothrow_t);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_sized_wrapper, __LGCPP_NAME(_ZdlPv, ));
+EXTERN_WEAK_ALIAS(__lgcpp_delete_sized_wrapper, __LGCPP_NAME(_ZdaPv, ));
+EXTERN_WEAK_ALIAS(__lgcpp_delete_aligned_wrapper, _ZdlPvSt11align_val_t);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_aligned_wrapper, _ZdaPvSt11align_val_t);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_aligned_nothrow_wrapper, _ZdlPvSt11align_val_tRKSt9nothrow_t);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_aligned_nothrow_wrapper, _ZdaPvSt11align_val_tRKSt9nothrow_t);
+EXTERN_WEAK_ALIAS(__lgcpp_delete_sized_aligned_wrapper, __LGCPP_NAME(_ZdlPv, St11align_val_t));
+EXTERN_WEAK_ALIAS(__lgcpp_delete_sized_aligned_wrapper, __LGCPP_NAME(_ZdaPv, St11align_val_t));
+#endif
+
+#undef __LGCPP_NAME
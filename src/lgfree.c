@@ -18,6 +18,8 @@ void __lgfree_impl(void *ptr)
 
 	if (UNLIKELY(!ptr))
 		return;
+
+	heap_free(ptr);
 }
 
 void __lgfree_wrapper(void *ptr)
@@ -25,7 +27,26 @@ void __lgfree_wrapper(void *ptr)
 	__lgfree_impl(ptr);
 }
 
+static ALWAYS_INLINE HOT_CALL
+void __lgfree_sized_impl(void *ptr, size_t size)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	if (UNLIKELY(!ptr))
+		return;
+
+	heap_free_sized(ptr, size);
+}
+
+void __lgfree_sized_wrapper(void *ptr, size_t size)
+{
+	__lgfree_sized_impl(ptr, size);
+}
+
 EXTERN_STRONG_ALIAS(__lgfree_wrapper, lgfree);
+EXTERN_STRONG_ALIAS(__lgfree_sized_wrapper, lgfree_sized);
 
 /* -DFORCE_LGMALLOC_REPLACE_STDLIB */
 #if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
@@ -37,3 +58,5 @@ EXTERN_STRONG_ALIAS(lgfree, free);
 EXTERN_WEAK_ALIAS(lgfree, free);
 #endif
 
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgfree_wrapper, __wrap_free);
@@ -0,0 +1,96 @@
+/* ******************************************** */
+/*                                              */
+/*   lgheap.c                                   */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+#include <errno.h>
+
+static ALWAYS_INLINE COLD_CALL
+heap_t *__lgheap_create_impl(void)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	heap_t *heap = heap_create();
+
+	if (UNLIKELY(!heap))
+		errno = ENOMEM;
+
+	return heap;
+}
+
+static ALWAYS_INLINE MALLOC_CALL(2) HOT_CALL
+void *__lgheap_malloc_impl(heap_t *heap, size_t size)
+{
+	if (UNLIKELY(!heap || size > LGMALLOC_MAX_ALLOC_SIZE))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	LGMALLOC_ASSERT(
+		atomic_load_explicit(&heap->tid, memory_order_relaxed) == lgmalloc_get_tid(),
+		"heap must only be allocated from by the thread that created it"
+	);
+
+	/* Unique pointers, like lgmalloc(0) */
+	if (UNLIKELY(!size))
+		size = 1;
+
+	return heap_alloc(heap, size);
+}
+
+/* Any thread may free, `heap` only documents where
+ * the memory came from, the pointer already knows */
+static ALWAYS_INLINE HOT_CALL
+void __lgheap_free_impl(heap_t *heap, void *ptr)
+{
+	DISCARD_ARGS(heap);
+
+	if (UNLIKELY(!ptr))
+		return;
+
+	heap_free(ptr);
+}
+
+static ALWAYS_INLINE COLD_CALL
+void __lgheap_destroy_impl(heap_t *heap)
+{
+	if (UNLIKELY(!heap))
+		return;
+
+	heap_destroy(heap);
+}
+
+heap_t *__lgheap_create_wrapper(void)
+{
+	return __lgheap_create_impl();
+}
+
+MALLOC_CALL(2)
+void *__lgheap_malloc_wrapper(heap_t *heap, size_t size)
+{
+	return __lgheap_malloc_impl(heap, size);
+}
+
+void __lgheap_free_wrapper(heap_t *heap, void *ptr)
+{
+	__lgheap_free_impl(heap, ptr);
+}
+
+void __lgheap_destroy_wrapper(heap_t *heap)
+{
+	__lgheap_destroy_impl(heap);
+}
+
+EXTERN_STRONG_ALIAS(__lgheap_create_wrapper, lgheap_create);
+EXTERN_STRONG_ALIAS(__lgheap_malloc_wrapper, lgheap_malloc);
+EXTERN_STRONG_ALIAS(__lgheap_free_wrapper, lgheap_free);
+EXTERN_STRONG_ALIAS(__lgheap_destroy_wrapper, lgheap_destroy);
@@ -8,7 +8,9 @@
 
 #include "internal/lgmalloc_global_include.h"
 #include "internal/thread_ctx.h"
+#include "internal/lgmalloc_size_classes.h"
 #include "api/lgmalloc_config.h"
+#include "api/lgmalloc.h"
 
 #include <errno.h>
 
@@ -34,7 +36,7 @@ void *__lgmalloc_impl(size_t size)
 	if (UNLIKELY(!size))
 		return do_alloc_size_1();
 
-	const heap_t *heap = get_current_thread_heap();
+	heap_t *heap = get_current_thread_heap();
 	GUARANTEE(heap, "heap must not be NULL");
 
 	return heap_alloc(heap, size);
@@ -50,12 +52,61 @@ void *__lgmalloc_wrapper(size_t size)
  * for sizeclass and mmap heuristic determinations */
 EXTERN_STRONG_ALIAS(__lgmalloc_wrapper, __lgmalloc);
 
+/* The `lgmalloc` macro resolves classes with its own copy
+ * of the layout, which has to match the configuration the
+ * library is built with */
+_Static_assert(
+	__LGMALLOC_CONST_GRANULARITY == LGMALLOC_SMALL_GRANULARITY,
+	"lgmalloc.h granularity does not match LGMALLOC_SMALL_GRANULARITY"
+);
+_Static_assert(
+	__LGMALLOC_CONST_MAX == LGMALLOC_MMAP_THRESHOLD,
+	"lgmalloc.h largest constant size does not match LGMALLOC_MMAP_THRESHOLD"
+);
+_Static_assert(
+	__LGMALLOC_CONST_CLASS(__LGMALLOC_CONST_MAX) < LGMALLOC_DEFAULT_SIZE_CLASS_COUNT,
+	"lgmalloc.h resolves classes past the default size classes"
+);
+
+/* `class` is the default size class of `size`,
+ * resolved at compile time by the `lgmalloc` macro */
+static ALWAYS_INLINE MALLOC_CALL(2) HOT_CALL
+void *__lgmalloc_class_impl(size_t class, size_t size)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	LGMALLOC_ASSERT(
+		size <= LGMALLOC_SMALL_GRANULARITY * 64
+			? class == (size + LGMALLOC_SMALL_GRANULARITY - 1) / LGMALLOC_SMALL_GRANULARITY
+			: class == __default_size_class(size) || !__default_size_class(size),
+		"lgmalloc.h resolved another class than __default_size_class"
+	);
+
+	heap_t *heap = get_current_thread_heap();
+	GUARANTEE(heap, "heap must not be NULL");
+
+	return heap_alloc_class(heap, class, size);
+}
+
+MALLOC_CALL(2)
+void *__lgmalloc_class_wrapper(size_t class, size_t size)
+{
+	return __lgmalloc_class_impl(class, size);
+}
+
+EXTERN_STRONG_ALIAS(__lgmalloc_class_wrapper, __lgmalloc_class);
+
 /* -DFORCE_LGMALLOC_REPLACE_STDLIB */
 #if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
-EXTERN_STRONG_ALIAS(lgmalloc, malloc);
+EXTERN_STRONG_ALIAS(__lgmalloc_wrapper, malloc);
 #endif
 
 /* -DWEAK_LGMALLOC_REPLACE_STDLIB */
 #if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
-EXTERN_WEAK_ALIAS(lgmalloc, malloc);
+EXTERN_WEAK_ALIAS(__lgmalloc_wrapper, malloc);
 #endif
+
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgmalloc_wrapper, __wrap_malloc);
@@ -0,0 +1,63 @@
+/* ******************************************** */
+/*                                              */
+/*   lgmalloc_size.c                            */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+static ALWAYS_INLINE HOT_CALL
+size_t __lgmalloc_usable_size_impl(void *ptr)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	if (UNLIKELY(!ptr))
+		return 0;
+
+	return heap_usable_size(ptr);
+}
+
+static ALWAYS_INLINE HOT_CALL
+size_t __lgmalloc_good_size_impl(size_t size)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	/* Nothing to round, the allocation would fail */
+	if (UNLIKELY(size > LGMALLOC_MAX_ALLOC_SIZE))
+		return size;
+
+	return heap_good_size(size);
+}
+
+size_t __lgmalloc_usable_size_wrapper(void *ptr)
+{
+	return __lgmalloc_usable_size_impl(ptr);
+}
+
+size_t __lgmalloc_good_size_wrapper(size_t size)
+{
+	return __lgmalloc_good_size_impl(size);
+}
+
+EXTERN_STRONG_ALIAS(__lgmalloc_usable_size_wrapper, lgmalloc_usable_size);
+EXTERN_STRONG_ALIAS(__lgmalloc_good_size_wrapper, lgmalloc_good_size);
+
+/* -DFORCE_LGMALLOC_REPLACE_STDLIB */
+#if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
+EXTERN_STRONG_ALIAS(lgmalloc_usable_size, malloc_usable_size);
+#endif
+
+/* -DWEAK_LGMALLOC_REPLACE_STDLIB */
+#if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
+EXTERN_WEAK_ALIAS(lgmalloc_usable_size, malloc_usable_size);
+#endif
+
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgmalloc_usable_size_wrapper, __wrap_malloc_usable_size);
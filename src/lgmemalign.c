@@ -0,0 +1,135 @@
+/* ******************************************** */
+/*                                              */
+/*   lgmemalign.c                               */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+#include <errno.h>
+
+static ALWAYS_INLINE CONST_CALL
+int __is_power_of_two(size_t value)
+{
+	return value && !(value & (value - 1));
+}
+
+/* Non-power of two alignments are rejected with EINVAL
+ * rather than silently rounded up like glibc does */
+static ALWAYS_INLINE MALLOC_CALL(2) HOT_CALL
+void *__lgmemalign_impl(size_t alignment, size_t size)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	if (UNLIKELY(!__is_power_of_two(alignment)))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (UNLIKELY(size > LGMALLOC_MAX_ALLOC_SIZE ||
+				 alignment > LGMALLOC_MAX_ALLOC_SIZE))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Still a unique pointer, like lgmalloc(0) */
+	if (UNLIKELY(!size))
+		size = 1;
+
+	heap_t *heap = get_current_thread_heap();
+	GUARANTEE(heap, "heap must not be NULL");
+
+	return heap_alloc_aligned(heap, size, alignment);
+}
+
+MALLOC_CALL(2)
+void *__lgmemalign_wrapper(size_t alignment, size_t size)
+{
+	return __lgmemalign_impl(alignment, size);
+}
+
+MALLOC_CALL(2)
+void *__lgaligned_alloc_wrapper(size_t alignment, size_t size)
+{
+	return __lgmemalign_impl(alignment, size);
+}
+
+/* Reports errors through its return value, errno is left alone */
+int __lgposix_memalign_wrapper(void **memptr, size_t alignment, size_t size)
+{
+	if (UNLIKELY(!__is_power_of_two(alignment) ||
+				 alignment % sizeof(void*)))
+		return EINVAL;
+
+	const int saved_errno = errno;
+
+	void *alloc = __lgmemalign_impl(alignment, size);
+
+	if (UNLIKELY(!alloc))
+	{
+		const int error = errno;
+		errno = saved_errno;
+		return error;
+	}
+
+	*memptr = alloc;
+
+	return 0;
+}
+
+MALLOC_CALL(1)
+void *__lgvalloc_wrapper(size_t size)
+{
+	return __lgmemalign_impl(PAGE_SIZE, size);
+}
+
+/* Whole pages, at least one of them */
+MALLOC_CALL(1)
+void *__lgpvalloc_wrapper(size_t size)
+{
+	if (UNLIKELY(size > LGMALLOC_MAX_ALLOC_SIZE))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return __lgmemalign_impl(PAGE_SIZE, size ? ALIGN_UP(size, PAGE_SIZE) : PAGE_SIZE);
+}
+
+EXTERN_STRONG_ALIAS(__lgmemalign_wrapper, lgmemalign);
+EXTERN_STRONG_ALIAS(__lgaligned_alloc_wrapper, lgaligned_alloc);
+EXTERN_STRONG_ALIAS(__lgposix_memalign_wrapper, lgposix_memalign);
+EXTERN_STRONG_ALIAS(__lgvalloc_wrapper, lgvalloc);
+EXTERN_STRONG_ALIAS(__lgpvalloc_wrapper, lgpvalloc);
+
+/* -DFORCE_LGMALLOC_REPLACE_STDLIB */
+#if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
+EXTERN_STRONG_ALIAS(lgmemalign, memalign);
+EXTERN_STRONG_ALIAS(lgaligned_alloc, aligned_alloc);
+EXTERN_STRONG_ALIAS(lgposix_memalign, posix_memalign);
+EXTERN_STRONG_ALIAS(lgvalloc, valloc);
+EXTERN_STRONG_ALIAS(lgpvalloc, pvalloc);
+#endif
+
+/* -DWEAK_LGMALLOC_REPLACE_STDLIB */
+#if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
+EXTERN_WEAK_ALIAS(lgmemalign, memalign);
+EXTERN_WEAK_ALIAS(lgaligned_alloc, aligned_alloc);
+EXTERN_WEAK_ALIAS(lgposix_memalign, posix_memalign);
+EXTERN_WEAK_ALIAS(lgvalloc, valloc);
+EXTERN_WEAK_ALIAS(lgpvalloc, pvalloc);
+#endif
+
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgmemalign_wrapper, __wrap_memalign);
+EXTERN_WEAK_ALIAS(__lgaligned_alloc_wrapper, __wrap_aligned_alloc);
+EXTERN_WEAK_ALIAS(__lgposix_memalign_wrapper, __wrap_posix_memalign);
+EXTERN_WEAK_ALIAS(__lgvalloc_wrapper, __wrap_valloc);
+EXTERN_WEAK_ALIAS(__lgpvalloc_wrapper, __wrap_pvalloc);
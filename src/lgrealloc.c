@@ -9,9 +9,61 @@
 #include "internal/lgmalloc_global_include.h"
 #include "api/lgmalloc_config.h"
 
+#include <string.h>
+#include <errno.h>
+
 static ALWAYS_INLINE HOT_CALL
 void *__lgrealloc_impl(void *ptr, size_t size)
 {
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	if (UNLIKELY(!ptr))
+		return __lgmalloc_wrapper(size);
+
+	if (UNLIKELY(!size))
+	{
+		__lgfree_wrapper(ptr);
+		return NULL;
+	}
+
+	if (UNLIKELY(size > LGMALLOC_MAX_ALLOC_SIZE))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Growing or shrinking within the size
+	 * class keeps the same pointer */
+	if (heap_fits_in_place(ptr, size))
+		return ptr;
+
+	/* Large buffers move through the page tables,
+	 * copying hundreds of MiB would stall the caller */
+	if (size >= LGMALLOC_MMAP_THRESHOLD)
+	{
+		void *remapped = heap_remap(ptr, size);
+
+		if (LIKELY(remapped))
+			return remapped;
+	}
+
+	const size_t usable = heap_usable_size(ptr);
+
+	void *alloc = __lgmalloc_wrapper(size);
+
+	if (UNLIKELY(!alloc))
+		return NULL;
+
+	/* Only what the old block can hold is meaningful.
+	 * libc already picks the widest copy the CPU can
+	 * run, so there is no vector path of our own here */
+	memcpy(alloc, ptr, usable < size ? usable : size);
+
+	__lgfree_wrapper(ptr);
+
+	return alloc;
 }
 
 void *__lgrealloc_wrapper(void *ptr, size_t size)
@@ -19,14 +71,36 @@ void *__lgrealloc_wrapper(void *ptr, size_t size)
 	return __lgrealloc_impl(ptr, size);
 }
 
+/* Like lgcalloc, an overflowing product fails rather
+ * than quietly resizing to the truncated size */
+void *__lgreallocarray_wrapper(void *ptr, size_t nmemb, size_t size)
+{
+	size_t total;
+
+	if (UNLIKELY(__builtin_mul_overflow(nmemb, size, &total)))
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return __lgrealloc_impl(ptr, total);
+}
+
 EXTERN_STRONG_ALIAS(__lgrealloc_wrapper, lgrealloc);
+EXTERN_STRONG_ALIAS(__lgreallocarray_wrapper, lgreallocarray);
 
 /* -DFORCE_LGMALLOC_REPLACE_STDLIB */
 #if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
 EXTERN_STRONG_ALIAS(lgrealloc, realloc);
+EXTERN_STRONG_ALIAS(lgreallocarray, reallocarray);
 #endif
 
 /* -DWEAK_LGMALLOC_REPLACE_STDLIB */
 #if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
 EXTERN_WEAK_ALIAS(lgrealloc, realloc);
+EXTERN_WEAK_ALIAS(lgreallocarray, reallocarray);
 #endif
+
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgrealloc_wrapper, __wrap_realloc);
+EXTERN_WEAK_ALIAS(__lgreallocarray_wrapper, __wrap_reallocarray);
@@ -0,0 +1,91 @@
+/* ******************************************** */
+/*                                              */
+/*   lgregion.c                                 */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+#include <errno.h>
+
+static ALWAYS_INLINE COLD_CALL
+region_t *__lgregion_create_impl(void)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	return region_create();
+}
+
+static ALWAYS_INLINE MALLOC_CALL(2) HOT_CALL
+void *__lgregion_alloc_impl(region_t *region, size_t size)
+{
+	if (UNLIKELY(!region || size > LGMALLOC_MAX_ALLOC_SIZE))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Unique pointers, like lgmalloc(0) */
+	if (UNLIKELY(!size))
+		size = 1;
+
+	return region_alloc(region, size);
+}
+
+static ALWAYS_INLINE HOT_CALL
+void __lgregion_reset_impl(region_t *region)
+{
+	if (LIKELY(region))
+		region_reset(region);
+}
+
+static ALWAYS_INLINE COLD_CALL
+void __lgregion_release_impl(region_t *region)
+{
+	if (LIKELY(region))
+		region_release(region);
+}
+
+static ALWAYS_INLINE COLD_CALL
+void __lgregion_destroy_impl(region_t *region)
+{
+	if (LIKELY(region))
+		region_destroy(region);
+}
+
+region_t *__lgregion_create_wrapper(void)
+{
+	return __lgregion_create_impl();
+}
+
+MALLOC_CALL(2)
+void *__lgregion_alloc_wrapper(region_t *region, size_t size)
+{
+	return __lgregion_alloc_impl(region, size);
+}
+
+void __lgregion_reset_wrapper(region_t *region)
+{
+	__lgregion_reset_impl(region);
+}
+
+void __lgregion_release_wrapper(region_t *region)
+{
+	__lgregion_release_impl(region);
+}
+
+void __lgregion_destroy_wrapper(region_t *region)
+{
+	__lgregion_destroy_impl(region);
+}
+
+EXTERN_STRONG_ALIAS(__lgregion_create_wrapper, lgregion_create);
+EXTERN_STRONG_ALIAS(__lgregion_alloc_wrapper, lgregion_alloc);
+EXTERN_STRONG_ALIAS(__lgregion_reset_wrapper, lgregion_reset);
+EXTERN_STRONG_ALIAS(__lgregion_release_wrapper, lgregion_release);
+EXTERN_STRONG_ALIAS(__lgregion_destroy_wrapper, lgregion_destroy);
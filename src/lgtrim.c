@@ -0,0 +1,48 @@
+/* ******************************************** */
+/*                                              */
+/*   lgtrim.c                                   */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "internal/lgmalloc_global_include.h"
+#include "api/lgmalloc_config.h"
+
+/* glibc keeps `pad` bytes at the top of its heap, we
+ * have no single top to keep them at. Only purges the
+ * calling thread's heap, other heaps still decay. */
+static ALWAYS_INLINE COLD_CALL
+int __lgmalloc_trim_impl(size_t pad)
+{
+#if !defined(MANUAL_HANDLE_LGMALLOC_INIT)
+	lgmalloc_init();
+#endif
+
+	DISCARD_ARGS(pad);
+
+	heap_t *heap = get_current_thread_heap();
+	GUARANTEE(heap, "heap must not be NULL");
+
+	return heap_trim(heap);
+}
+
+int __lgmalloc_trim_wrapper(size_t pad)
+{
+	return __lgmalloc_trim_impl(pad);
+}
+
+EXTERN_STRONG_ALIAS(__lgmalloc_trim_wrapper, lgmalloc_trim);
+
+/* -DFORCE_LGMALLOC_REPLACE_STDLIB */
+#if defined(FORCE_LGMALLOC_REPLACE_STDLIB)
+EXTERN_STRONG_ALIAS(lgmalloc_trim, malloc_trim);
+#endif
+
+/* -DWEAK_LGMALLOC_REPLACE_STDLIB */
+#if defined(WEAK_LGMALLOC_REPLACE_STDLIB)
+EXTERN_WEAK_ALIAS(lgmalloc_trim, malloc_trim);
+#endif
+
+/* Linked with MALLOC_REPLACE_FLAGS, see the Makefile */
+EXTERN_WEAK_ALIAS(__lgmalloc_trim_wrapper, __wrap_malloc_trim);
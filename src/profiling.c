@@ -7,6 +7,7 @@
 /* ******************************************** */
 
 #include "internal/lgmalloc_global_include.h"
+#include "internal/lgmalloc_heuristics.h"
 #include "api/lgmalloc_profiling.h"
 
 /* Internal malloc profiling system
@@ -16,6 +17,15 @@
 #include <unwind.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #define __RET_ADDR_P(x)	\
 	__builtin_return_address(x);
@@ -63,10 +73,292 @@ prof_config_t *__unsafe_get_current_thread_config(void)
 	return __current_thread_config_g;
 }
 
+#ifdef LGMALLOC_ENABLE_PROFILING
+
+/*
+ * Persisted allocation profile.
+ *
+ * With LGMALLOC_PROFILE_ENV naming a file, a run writes
+ * what it saw there at exit, replacing the last one:
+ * the constant sizes of the call sites with how often
+ * they were called over the whole run, and how many
+ * chunks of each size class the busiest heap carved.
+ * 
+ * Call counts live in each thread's TLS, so a thread
+ * that allocated folds its own into `__profile_exited_g`
+ * as it exits. At exit the exiting thread's counts are
+ * added to those. Threads still running then, or
+ * killed rather than exited, aren't counted.
+ *
+ * The next run reads it back at init. The sizes fold
+ * into the startup heuristics before any size classes
+ * are built, so classes follow what the call sites did
+ * over a whole run rather than before `main`. New
+ * heaps carve the recorded chunks right away, see
+ * `heap_warm_start`, so early allocations don't
+ * take the slow path for them.
+ *
+ * Warm started chunks count as carved, so chunk
+ * counts never drop while a profile is in use,
+ * removing the file starts over. Classes are
+ * recorded by their block size, a build whose
+ * layout differs simply matches fewer. Runs that
+ * don't exit normally leave the old profile, it's
+ * only replaced once fully written.
+ *
+ * Nothing here may allocate.
+ */
+
+static const char *__profile_path_g;
+
+static pthread_once_t __profile_once_g = PTHREAD_ONCE_INIT;
+
+static pthread_key_t	__profile_thread_key_g;
+
+/* What threads that already exited counted */
+static lgmalloc_heuristics_t	__profile_exited_g;
+static pthread_mutex_t			__profile_exited_lock_g = PTHREAD_MUTEX_INITIALIZER;
+
+/* Read into at init, written from at exit */
+static lgmalloc_heuristics_t		__profile_sizes_g;
+static lgmalloc_profile_class_t	__profile_classes_g[LGMALLOC_SIZE_CLASS_MAX];
+static size_t					__profile_class_count_g;
+
+static _Atomic size_t __profile_chunks_g[LGMALLOC_SIZE_CLASS_MAX];
+static _Atomic size_t __profile_block_sizes_g[LGMALLOC_SIZE_CLASS_MAX];
+
+/* A heap carved its `chunks`th chunk of `class`,
+ * only the busiest heap's count is kept */
+COLD_CALL
+void prof_record_chunks(size_t class, size_t block_size, size_t chunks)
+{
+	atomic_store_explicit(&__profile_block_sizes_g[class], block_size, memory_order_relaxed);
+
+	size_t seen = atomic_load_explicit(&__profile_chunks_g[class], memory_order_relaxed);
+
+	while (seen < chunks && !atomic_compare_exchange_weak_explicit(
+		&__profile_chunks_g[class], &seen, chunks,
+		memory_order_relaxed, memory_order_relaxed
+	));
+}
+
+/* Chunks of `block_size` the last run needed */
+COLD_CALL
+size_t prof_warm_chunks(size_t block_size)
+{
+	for (size_t i = 0; i < __profile_class_count_g; ++i)
+		if (__profile_classes_g[i].block_size == block_size)
+			return __profile_classes_g[i].chunks < LGMALLOC_PROFILE_MAX_CHUNKS
+				 ? __profile_classes_g[i].chunks : LGMALLOC_PROFILE_MAX_CHUNKS;
+
+	return 0;
+}
+
+static COLD_CALL NO_NULL_ARGS
+int prof_read_all(int fd, void *buf, size_t len)
+{
+	while (len)
+	{
+		const ssize_t ret = read(fd, buf, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return 0;
+
+		buf = OFFSET_PTR(buf, ret);
+		len -= (size_t)ret;
+	}
+
+	return 1;
+}
+
+static COLD_CALL NO_NULL_ARGS
+int prof_write_all(int fd, const void *buf, size_t len)
+{
+	while (len)
+	{
+		const ssize_t ret = write(fd, buf, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			return 0;
+
+		buf = (const unsigned char*)buf + ret;
+		len -= (size_t)ret;
+	}
+
+	return 1;
+}
+
+/* Runs on thread exit while the thread's TLS, and
+ * with it its call counts, is still there */
+static COLD_CALL
+void prof_thread_exit(void *arg)
+{
+	DISCARD_ARGS(arg);
+
+	lgmalloc_heuristics_t counts;
+
+	heuristics_snapshot(&counts);
+
+	pthread_mutex_lock(&__profile_exited_lock_g);
+	heuristics_fold(&__profile_exited_g, &counts);
+	pthread_mutex_unlock(&__profile_exited_lock_g);
+}
+
+/* Every thread with a heap, only the key's value
+ * being set makes its destructor run */
+COLD_CALL
+void prof_thread_attach(void)
+{
+	if (__profile_path_g)
+		pthread_setspecific(__profile_thread_key_g, (void*)1);
+}
+
+/* A missing or foreign profile is just a cold start */
+static COLD_CALL
+void prof_load_profile(void)
+{
+	const int fd = open(__profile_path_g, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return;
+
+	lgmalloc_profile_header_t header;
+
+	const int valid =
+		prof_read_all(fd, &header, sizeof(header))						&&
+		header.magic			== LGMALLOC_PROFILE_MAGIC				&&
+		header.version			== LGMALLOC_PROFILE_VERSION				&&
+		header.size_entry_size	== sizeof(lgmalloc_heuristic_size_t)	&&
+		header.class_entry_size	== sizeof(lgmalloc_profile_class_t)		&&
+		header.size_count		<= LGMALLOC_HEURISTICS_MAX_SIZES		&&
+		header.class_count		<= LGMALLOC_SIZE_CLASS_MAX				&&
+		prof_read_all(
+			fd, __profile_sizes_g.sizes,
+			header.size_count * sizeof(lgmalloc_heuristic_size_t)
+		)																&&
+		prof_read_all(
+			fd, __profile_classes_g,
+			header.class_count * sizeof(lgmalloc_profile_class_t)
+		);
+
+	close(fd);
+
+	if (!valid)
+		return;
+
+	__profile_sizes_g.size_count	= header.size_count;
+	__profile_sizes_g.runtime_sites	= header.runtime_sites;
+	__profile_sizes_g.runtime_freq	= header.runtime_freq;
+	__profile_class_count_g			= header.class_count;
+
+	heuristics_merge(&__profile_sizes_g);
+}
+
+/* Written next to the profile, then renamed over it */
+static COLD_CALL
+void prof_write_profile(void)
+{
+	static const char suffix[] = ".tmp";
+
+	char tmp[PATH_MAX];
+
+	const size_t len = strlen(__profile_path_g);
+
+	if (len + sizeof(suffix) > sizeof(tmp))
+		return;
+
+	memcpy(tmp, __profile_path_g, len);
+	memcpy(tmp + len, suffix, sizeof(suffix));
+
+	heuristics_snapshot(&__profile_sizes_g);
+
+	pthread_mutex_lock(&__profile_exited_lock_g);
+	heuristics_fold(&__profile_sizes_g, &__profile_exited_g);
+	pthread_mutex_unlock(&__profile_exited_lock_g);
+
+	size_t count = 0;
+
+	for (size_t class = 1; class < LGMALLOC_SIZE_CLASS_MAX; ++class)
+	{
+		const size_t chunks = atomic_load_explicit(
+			&__profile_chunks_g[class], memory_order_relaxed
+		);
+
+		if (!chunks)
+			continue;
+
+		__profile_classes_g[count++] = (lgmalloc_profile_class_t){
+			.block_size	= atomic_load_explicit(
+				&__profile_block_sizes_g[class], memory_order_relaxed
+			),
+			.chunks		= chunks
+		};
+	}
+
+	__profile_class_count_g = count;
+
+	const lgmalloc_profile_header_t header = {
+		.magic				= LGMALLOC_PROFILE_MAGIC,
+		.version			= LGMALLOC_PROFILE_VERSION,
+		.size_entry_size	= sizeof(lgmalloc_heuristic_size_t),
+		.class_entry_size	= sizeof(lgmalloc_profile_class_t),
+		.size_count			= __profile_sizes_g.size_count,
+		.class_count		= count,
+		.runtime_sites		= __profile_sizes_g.runtime_sites,
+		.runtime_freq		= __profile_sizes_g.runtime_freq
+	};
+
+	const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return;
+
+	const int written =
+		prof_write_all(fd, &header, sizeof(header)) &&
+		prof_write_all(
+			fd, __profile_sizes_g.sizes,
+			header.size_count * sizeof(lgmalloc_heuristic_size_t)
+		) &&
+		prof_write_all(
+			fd, __profile_classes_g,
+			count * sizeof(lgmalloc_profile_class_t)
+		);
+
+	if (close(fd) || !written || rename(tmp, __profile_path_g))
+		unlink(tmp);
+}
+
+static COLD_CALL
+void prof_init_profile(void)
+{
+	const char *path = getenv(LGMALLOC_PROFILE_ENV);
+
+	if (!path || !*path)
+		return;
+
+	if (pthread_key_create(&__profile_thread_key_g, prof_thread_exit))
+		return;
+
+	__profile_path_g = path;
+
+	prof_load_profile();
+
+	atexit(prof_write_profile);
+}
+
+#endif /* LGMALLOC_ENABLE_PROFILING */
+
 NO_INLINE COLD_CALL FLATTEN
 void __init_prof_system(void)
 {
 #ifdef LGMALLOC_ENABLE_PROFILING
+	pthread_once(&__profile_once_g, prof_init_profile);
 #else
 	DISCARD_BRANCH;
 #endif
@@ -0,0 +1,33 @@
+/* ******************************************** */
+/*                                              */
+/*   lgtest.h                                   */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#ifndef __LGTEST_H
+#define __LGTEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Every test is its own program, the first
+ * failed check reports itself and exits */
+
+#define TEST_ASSERT(cond, msg)									\
+	do {														\
+		if (!(cond))											\
+		{														\
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, msg);	\
+			exit(EXIT_FAILURE);									\
+		}														\
+	} while (0)
+
+#define TEST_PASS()												\
+	do {														\
+		printf("%s: passed\n", __FILE__);						\
+		return EXIT_SUCCESS;									\
+	} while (0)
+
+#endif /* __LGTEST_H */
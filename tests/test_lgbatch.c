@@ -0,0 +1,134 @@
+/* ******************************************** */
+/*                                              */
+/*   test_lgbatch.c                             */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define COUNT_OF(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/* Enough blocks per size to span several chunks */
+#define TEST_BATCH		4096
+#define TEST_ROUNDS		8
+
+static const size_t __sizes[] = { 16, 48, 200, 1000, 6000 };
+
+#define TEST_TOTAL		(TEST_BATCH * COUNT_OF(__sizes))
+
+static void *__blocks_g[TEST_TOTAL];
+
+static unsigned char tag_of(const void *ptr)
+{
+	return (unsigned char)(((uintptr_t)ptr >> 4) ^ 0xA5);
+}
+
+static void alloc_all(void)
+{
+	for (size_t s = 0; s < COUNT_OF(__sizes); ++s)
+	{
+		void **out = __blocks_g + s * TEST_BATCH;
+
+		TEST_ASSERT(lgmalloc_batch(__sizes[s], TEST_BATCH, out) == TEST_BATCH,
+					"batch allocation came up short");
+
+		for (size_t i = 0; i < TEST_BATCH; ++i)
+			memset(out[i], tag_of(out[i]), __sizes[s]);
+	}
+
+	for (size_t s = 0; s < COUNT_OF(__sizes); ++s)
+		for (size_t i = 0; i < TEST_BATCH; ++i)
+		{
+			const unsigned char *bytes = (const unsigned char*)__blocks_g[s * TEST_BATCH + i];
+
+			TEST_ASSERT(bytes[0] == tag_of(bytes) &&
+						bytes[__sizes[s] - 1] == tag_of(bytes),
+						"batch allocations overlap");
+		}
+}
+
+/* Deterministic shuffle, so pointers of every chunk
+ * and class come interleaved rather than in runs */
+static void shuffle_all(unsigned seed)
+{
+	for (size_t i = TEST_TOTAL - 1; i > 0; --i)
+	{
+		seed = seed * 1103515245u + 12345u;
+
+		const size_t j	= (seed >> 8) % (i + 1);
+		void *tmp		= __blocks_g[i];
+
+		__blocks_g[i]	= __blocks_g[j];
+		__blocks_g[j]	= tmp;
+	}
+}
+
+/* Interleaved frees must still hand every block back,
+ * so the same batches fit again without growing */
+static void test_interleaved(void)
+{
+	for (unsigned round = 0; round < TEST_ROUNDS; ++round)
+	{
+		alloc_all();
+
+		if (round & 1)
+			shuffle_all(round);
+
+		lgfree_batch(__blocks_g, TEST_TOTAL);
+	}
+}
+
+static void test_null_entries(void)
+{
+	alloc_all();
+
+	for (size_t i = 0; i < TEST_TOTAL; i += 3)
+	{
+		lgfree(__blocks_g[i]);
+		__blocks_g[i] = NULL;
+	}
+
+	shuffle_all(7);
+	lgfree_batch(__blocks_g, TEST_TOTAL);
+}
+
+static void *free_remote(void *arg)
+{
+	(void)arg;
+
+	shuffle_all(11);
+	lgfree_batch(__blocks_g, TEST_TOTAL);
+
+	return NULL;
+}
+
+/* Blocks of another thread's heap take the remote path */
+static void test_remote(void)
+{
+	pthread_t thread;
+
+	alloc_all();
+
+	TEST_ASSERT(!pthread_create(&thread, NULL, free_remote, NULL), "pthread_create failed");
+	TEST_ASSERT(!pthread_join(thread, NULL), "pthread_join failed");
+
+	/* Drains what came back through `thread_free` */
+	alloc_all();
+	lgfree_batch(__blocks_g, TEST_TOTAL);
+}
+
+int main(void)
+{
+	test_interleaved();
+	test_null_entries();
+	test_remote();
+
+	TEST_PASS();
+}
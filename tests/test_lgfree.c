@@ -0,0 +1,128 @@
+/* ******************************************** */
+/*                                              */
+/*   test_lgfree.c                              */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define COUNT_OF(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static const size_t __sizes[] = {
+	1, 8, 16, 24, 100, 512, 1000, 1024, 1500,
+	4096, 10000, 65536, 100000, 300000, (size_t)1 << 20
+};
+
+static void fill(void *ptr, size_t size, unsigned char byte)
+{
+	memset(ptr, byte, size);
+}
+
+static int holds(const void *ptr, size_t size, unsigned char byte)
+{
+	const unsigned char *bytes = (const unsigned char*)ptr;
+
+	for (size_t i = 0; i < size; ++i)
+		if (bytes[i] != byte)
+			return 0;
+
+	return 1;
+}
+
+static void test_free_null(void)
+{
+	lgfree(NULL);
+	lgfree_sized(NULL, 16);
+}
+
+static void test_free_sized(void)
+{
+	for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+	{
+		void *ptr = lgmalloc(__sizes[i]);
+
+		TEST_ASSERT(ptr, "malloc failed");
+
+		fill(ptr, __sizes[i], 0x5A);
+		lgfree_sized(ptr, __sizes[i]);
+	}
+}
+
+/* Shrinking either keeps the block within its class or
+ * moves it to the smaller one, freeing it with the new
+ * size must file it with the class it ended up in. */
+static void test_free_sized_after_realloc(void)
+{
+	void *live[COUNT_OF(__sizes)];
+
+	for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+	{
+		const size_t shrunk = __sizes[i] - __sizes[i] / 3;
+
+		void *ptr = lgmalloc(__sizes[i]);
+
+		TEST_ASSERT(ptr, "malloc failed");
+
+		void *resized = lgrealloc(ptr, shrunk);
+
+		TEST_ASSERT(resized, "realloc failed");
+
+		fill(resized, shrunk, 0xC3);
+		lgfree_sized(resized, shrunk);
+	}
+
+	/* Blocks filed with the wrong class would be handed
+	 * out again for sizes they can't hold */
+	for (size_t round = 0; round < 64; ++round)
+	{
+		for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+		{
+			TEST_ASSERT(live[i] = lgmalloc(__sizes[i]), "malloc failed");
+			TEST_ASSERT(lgmalloc_usable_size(live[i]) >= __sizes[i],
+						"block is smaller than requested");
+
+			fill(live[i], __sizes[i], (unsigned char)i);
+		}
+
+		for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+		{
+			TEST_ASSERT(holds(live[i], __sizes[i], (unsigned char)i), "allocations overlap");
+			lgfree_sized(live[i], __sizes[i]);
+		}
+	}
+}
+
+/* Growing within the block keeps it too */
+static void test_free_sized_after_grow(void)
+{
+	for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+	{
+		void *ptr = lgmalloc(__sizes[i]);
+
+		TEST_ASSERT(ptr, "malloc failed");
+
+		const size_t usable = lgmalloc_usable_size(ptr);
+		void *resized		= lgrealloc(ptr, usable);
+
+		TEST_ASSERT(resized, "realloc failed");
+
+		fill(resized, usable, 0x3C);
+		lgfree_sized(resized, usable);
+	}
+}
+
+int main(void)
+{
+	test_free_null();
+	test_free_sized();
+	test_free_sized_after_realloc();
+	test_free_sized_after_grow();
+
+	TEST_PASS();
+}
@@ -0,0 +1,132 @@
+/* ******************************************** */
+/*                                              */
+/*   test_lgmalloc.c                            */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Past the mmap threshold every size gets its own mapping */
+#define TEST_MAX_SIZE	((size_t)1 << 19)
+
+#define TEST_THREADS	4
+
+static void test_malloc_zero(void)
+{
+	void *ptr = lgmalloc(0);
+
+	lgfree(ptr);
+}
+
+/* Whichever way the size classes were derived, a size
+ * must land in the same class through the allocation
+ * path as through the plain lookup `good_size` does */
+static void test_class_lookup(size_t *checked)
+{
+	size_t previous = 0;
+	size_t count	= 0;
+
+	for (size_t size = 1; size <= TEST_MAX_SIZE; size += size < 4096 ? 1 : 61)
+	{
+		const size_t good = lgmalloc_good_size(size);
+
+		TEST_ASSERT(good >= size, "good size is smaller than the size");
+		TEST_ASSERT(good >= previous, "good sizes are not monotonic");
+
+		void *ptr = lgmalloc(size);
+
+		TEST_ASSERT(ptr, "malloc failed");
+		TEST_ASSERT(!((uintptr_t)ptr & (sizeof(void*) - 1)), "pointer is not aligned");
+		TEST_ASSERT(lgmalloc_usable_size(ptr) == good,
+					"allocation and lookup disagree on the class");
+
+		memset(ptr, 0x7E, size);
+		lgfree(ptr);
+
+		previous = good;
+		checked[count++] = good;
+	}
+}
+
+#define TEST_LOOKUPS	(4096 + (TEST_MAX_SIZE - 4096) / 61 + 1)
+
+static size_t __main_classes_g[TEST_LOOKUPS];
+
+/* Size classes are built once for the process,
+ * every thread has to see the very same ones */
+static void *thread_main(void *arg)
+{
+	size_t *classes = (size_t*)arg;
+
+	test_class_lookup(classes);
+
+	return NULL;
+}
+
+static void test_threads_share_classes(void)
+{
+	static size_t classes[TEST_THREADS][TEST_LOOKUPS];
+	pthread_t threads[TEST_THREADS];
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		TEST_ASSERT(!pthread_create(&threads[i], NULL, thread_main, classes[i]),
+					"pthread_create failed");
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		TEST_ASSERT(!memcmp(classes[i], __main_classes_g, sizeof(__main_classes_g)),
+					"threads derived different size classes");
+}
+
+/* Constant sizes skip the lookup and enter the heap with
+ * their class resolved at compile time. They have to end
+ * up in the same class as the same size at runtime. */
+#define CHECK_CONST_SIZE(sz)											\
+	do {																\
+		void *ptr = lgmalloc(sz);										\
+																		\
+		TEST_ASSERT(ptr, "malloc failed for " #sz);						\
+		TEST_ASSERT(lgmalloc_usable_size(ptr) == lgmalloc_good_size(sz),	\
+					"constant size " #sz " took another class");		\
+																		\
+		memset(ptr, 0x11, sz);											\
+		lgfree(ptr);													\
+	} while (0)
+
+static void test_const_sizes(void)
+{
+	CHECK_CONST_SIZE(1);
+	CHECK_CONST_SIZE(16);
+	CHECK_CONST_SIZE(17);
+	CHECK_CONST_SIZE(1024);
+	CHECK_CONST_SIZE(1025);
+	CHECK_CONST_SIZE(1100);
+	CHECK_CONST_SIZE(4096);
+	CHECK_CONST_SIZE(5000);
+	CHECK_CONST_SIZE(65536);
+	CHECK_CONST_SIZE(100000);
+	CHECK_CONST_SIZE(458752);
+	CHECK_CONST_SIZE(458753);
+	CHECK_CONST_SIZE(524287);
+	CHECK_CONST_SIZE(524288);
+	CHECK_CONST_SIZE(600000);
+}
+
+int main(void)
+{
+	test_malloc_zero();
+	test_class_lookup(__main_classes_g);
+	test_const_sizes();
+	test_threads_share_classes();
+
+	TEST_PASS();
+}
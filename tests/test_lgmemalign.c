@@ -0,0 +1,118 @@
+/* ******************************************** */
+/*                                              */
+/*   test_lgmemalign.c                          */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Sizes at and past the mmap threshold, aligned requests
+ * for them get a dedicated mapping trimmed to the pages
+ * holding the header and the payload. Alignments below a
+ * page leave the payload ending mid page, which used to
+ * trim past the end of the mapping. */
+
+static const size_t __sizes[] = {
+	(size_t)1 << 19,
+	((size_t)1 << 19) + 1,
+	(size_t)1 << 20,
+	((size_t)1 << 20) + 12345,
+	(size_t)3 << 21
+};
+
+static const size_t __alignments[] = {
+	16, 32, 64, 256, 1024, 4096, 8192, 65536, (size_t)1 << 21
+};
+
+#define COUNT_OF(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/* Every page the allocation spans must still be mapped */
+static void check_mapped(void *ptr, size_t size)
+{
+	const uintptr_t page	= (uintptr_t)sysconf(_SC_PAGESIZE);
+	const uintptr_t first	= (uintptr_t)ptr & ~(page - 1);
+	const uintptr_t last	= ((uintptr_t)ptr + size + page - 1) & ~(page - 1);
+
+	unsigned char vec[4096];
+
+	for (uintptr_t at = first; at < last; at += page * sizeof(vec))
+	{
+		size_t length = last - at;
+
+		if (length > page * sizeof(vec))
+			length = page * sizeof(vec);
+
+		TEST_ASSERT(!mincore((void*)at, length, vec), "allocation is not fully mapped");
+	}
+}
+
+static void test_posix_memalign(void)
+{
+	for (size_t a = 0; a < COUNT_OF(__alignments); ++a)
+		for (size_t s = 0; s < COUNT_OF(__sizes); ++s)
+		{
+			void *ptr = NULL;
+
+			TEST_ASSERT(!lgposix_memalign(&ptr, __alignments[a], __sizes[s]),
+						"posix_memalign failed");
+			TEST_ASSERT(ptr, "posix_memalign returned NULL");
+			TEST_ASSERT(!((uintptr_t)ptr & (__alignments[a] - 1)),
+						"pointer is not aligned");
+
+			const size_t usable = lgmalloc_usable_size(ptr);
+
+			TEST_ASSERT(usable >= __sizes[s], "usable size is smaller than requested");
+
+			check_mapped(ptr, usable);
+			memset(ptr, 0xA5, usable);
+
+			lgfree(ptr);
+		}
+}
+
+/* Aligned mappings freed and taken again must not lose
+ * pages, whether they come back from the cache or not */
+static void test_reuse(void)
+{
+	void *ptrs[16];
+
+	for (int round = 0; round < 4; ++round)
+	{
+		for (size_t i = 0; i < COUNT_OF(ptrs); ++i)
+		{
+			ptrs[i] = lgmemalign(64, (size_t)1 << 20);
+
+			TEST_ASSERT(ptrs[i], "memalign failed");
+			TEST_ASSERT(!((uintptr_t)ptrs[i] & 63), "pointer is not aligned");
+
+			memset(ptrs[i], (int)i, (size_t)1 << 20);
+		}
+
+		for (size_t i = 0; i < COUNT_OF(ptrs); ++i)
+		{
+			const unsigned char *bytes = (const unsigned char*)ptrs[i];
+
+			TEST_ASSERT(bytes[0] == (unsigned char)i && bytes[((size_t)1 << 20) - 1] == (unsigned char)i,
+						"allocations overlap");
+		}
+
+		for (size_t i = 0; i < COUNT_OF(ptrs); ++i)
+			lgfree(ptrs[i]);
+	}
+}
+
+int main(void)
+{
+	test_posix_memalign();
+	test_reuse();
+
+	TEST_PASS();
+}
@@ -0,0 +1,133 @@
+/* ******************************************** */
+/*                                              */
+/*   test_lgrealloc.c                           */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define COUNT_OF(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define TEST_GROW_LIMIT	((size_t)4 << 20)
+
+static const size_t __sizes[] = {
+	1, 24, 100, 1000, 1500, 10000, 100000, 300000
+};
+
+static void fill(void *ptr, size_t size)
+{
+	unsigned char *bytes = (unsigned char*)ptr;
+
+	for (size_t i = 0; i < size; ++i)
+		bytes[i] = (unsigned char)(i * 7 + 3);
+}
+
+static int holds(const void *ptr, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*)ptr;
+
+	for (size_t i = 0; i < size; ++i)
+		if (bytes[i] != (unsigned char)(i * 7 + 3))
+			return 0;
+
+	return 1;
+}
+
+static void test_edge_cases(void)
+{
+	void *ptr = lgrealloc(NULL, 64);
+
+	TEST_ASSERT(ptr, "realloc of NULL must allocate");
+	TEST_ASSERT(!lgrealloc(ptr, 0), "realloc to 0 must free");
+}
+
+/* Growing up to what the block already holds keeps it */
+static void test_grow_in_place(void)
+{
+	for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+	{
+		void *ptr = lgmalloc(__sizes[i]);
+
+		TEST_ASSERT(ptr, "malloc failed");
+		fill(ptr, __sizes[i]);
+
+		const size_t	usable	= lgmalloc_usable_size(ptr);
+		const uintptr_t	addr	= (uintptr_t)ptr;
+
+		void *resized = lgrealloc(ptr, usable);
+
+		TEST_ASSERT((uintptr_t)resized == addr, "growing within the block moved it");
+		TEST_ASSERT(holds(resized, __sizes[i]), "contents lost in place");
+
+		lgfree(resized);
+	}
+}
+
+/* Shrinking into a smaller class moves the object there,
+ * the old block isn't kept for the smaller size */
+static void test_shrink_moves(void)
+{
+	for (size_t i = 0; i < COUNT_OF(__sizes); ++i)
+	{
+		const size_t shrunk = __sizes[i] / 2 + 1;
+
+		if (lgmalloc_good_size(shrunk) == lgmalloc_good_size(__sizes[i]))
+			continue;
+
+		void *ptr = lgmalloc(__sizes[i]);
+
+		TEST_ASSERT(ptr, "malloc failed");
+		fill(ptr, __sizes[i]);
+
+		void *resized = lgrealloc(ptr, shrunk);
+
+		TEST_ASSERT(resized, "realloc failed");
+		TEST_ASSERT(lgmalloc_usable_size(resized) == lgmalloc_good_size(shrunk),
+					"shrunk block was not moved to its class");
+		TEST_ASSERT(holds(resized, shrunk), "contents lost when shrinking");
+
+		lgfree(resized);
+	}
+}
+
+/* Like a string builder, every class on the way up
+ * and the dedicated mappings past the threshold */
+static void test_grow_across_classes(void)
+{
+	size_t	size	= 1;
+	char	*ptr	= lgmalloc(size);
+
+	TEST_ASSERT(ptr, "malloc failed");
+	fill(ptr, size);
+
+	while (size < TEST_GROW_LIMIT)
+	{
+		const size_t grown = size + size / 2 + 1;
+
+		ptr = lgrealloc(ptr, grown);
+
+		TEST_ASSERT(ptr, "realloc failed");
+		TEST_ASSERT(holds(ptr, size), "contents lost when growing");
+
+		fill(ptr, grown);
+		size = grown;
+	}
+
+	lgfree(ptr);
+}
+
+int main(void)
+{
+	test_edge_cases();
+	test_grow_in_place();
+	test_shrink_moves();
+	test_grow_across_classes();
+
+	TEST_PASS();
+}
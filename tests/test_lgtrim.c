@@ -0,0 +1,113 @@
+/* ******************************************** */
+/*                                              */
+/*   test_lgtrim.c                              */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Enough blocks to span a good number of chunks */
+#define TEST_BLOCKS		(64 * 1024)
+#define TEST_SIZE		1000
+
+#define TEST_ROUNDS		6
+
+static void *__blocks_g[TEST_BLOCKS];
+
+/* Virtual and resident sizes in bytes, from /proc */
+static void read_statm(size_t *size, size_t *resident)
+{
+	FILE *file = fopen("/proc/self/statm", "r");
+
+	TEST_ASSERT(file, "can't open /proc/self/statm");
+	TEST_ASSERT(fscanf(file, "%zu %zu", size, resident) == 2, "can't read /proc/self/statm");
+
+	fclose(file);
+
+	*size		*= (size_t)sysconf(_SC_PAGESIZE);
+	*resident	*= (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void alloc_all(void)
+{
+	for (size_t i = 0; i < TEST_BLOCKS; ++i)
+	{
+		TEST_ASSERT(__blocks_g[i] = lgmalloc(TEST_SIZE), "malloc failed");
+		memset(__blocks_g[i], (int)(i & 0xFF), TEST_SIZE);
+	}
+
+	for (size_t i = 0; i < TEST_BLOCKS; ++i)
+	{
+		const unsigned char *bytes = (const unsigned char*)__blocks_g[i];
+
+		TEST_ASSERT(bytes[0] == (unsigned char)(i & 0xFF) &&
+					bytes[TEST_SIZE - 1] == (unsigned char)(i & 0xFF),
+					"allocations overlap");
+	}
+}
+
+static void free_all(void)
+{
+	for (size_t i = 0; i < TEST_BLOCKS; ++i)
+		lgfree(__blocks_g[i]);
+}
+
+/* Trimming hands the pages of empty chunks back right
+ * away, except in huge page builds, which never purge */
+#if !defined(LGMALLOC_ENABLE_HUGEPAGES)
+static void test_trim_releases(void)
+{
+	size_t size, before, after;
+
+	alloc_all();
+	read_statm(&size, &before);
+
+	free_all();
+	TEST_ASSERT(lgmalloc_trim(0), "trim released nothing");
+
+	read_statm(&size, &after);
+
+	TEST_ASSERT(before - after >= (size_t)TEST_BLOCKS * TEST_SIZE / 2,
+				"trim left the empty chunks resident");
+}
+#endif
+
+/* Purged chunks are taken back before new ones are
+ * carved, so cycling through the same amount of memory
+ * must not keep growing the address space */
+static void test_purged_reuse(void)
+{
+	size_t first = 0, size, resident;
+
+	for (int round = 0; round < TEST_ROUNDS; ++round)
+	{
+		alloc_all();
+		read_statm(&size, &resident);
+
+		if (!round)
+			first = size;
+
+		TEST_ASSERT(size <= first + ((size_t)TEST_BLOCKS * TEST_SIZE) / 4,
+					"purged chunks are not reused");
+
+		free_all();
+		lgmalloc_trim(0);
+	}
+}
+
+int main(void)
+{
+#if !defined(LGMALLOC_ENABLE_HUGEPAGES)
+	test_trim_releases();
+#endif
+	test_purged_reuse();
+
+	TEST_PASS();
+}
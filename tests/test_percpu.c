@@ -0,0 +1,187 @@
+/* ******************************************** */
+/*                                              */
+/*   test_percpu.c                              */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#define _GNU_SOURCE
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Meant for builds with LGMALLOC_ENABLE_PERCPU, where every
+ * thread shares one heap behind per-CPU bins, but any
+ * build has to pass it. Threads hop between CPUs so bins
+ * of several CPUs fill and drain, and hand blocks to each
+ * other so that every free may land on another CPU. */
+
+#define TEST_THREADS	8
+#define TEST_ITERATIONS	20000
+#define TEST_LIVE		256
+#define TEST_RING		1024
+
+static const size_t __sizes[] = {
+	8, 24, 48, 100, 256, 1000, 4000, 20000, 100000, 700000
+};
+
+#define COUNT_OF(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+typedef struct
+{
+	void			*slots[TEST_RING];
+	size_t			sizes[TEST_RING];
+	size_t			head;
+	size_t			tail;
+	pthread_mutex_t	lock;
+}	ring_t;
+
+static ring_t	__rings_g[TEST_THREADS];
+static long		__cpus_g;
+
+/* Every byte of a block carries a tag derived from
+ * its address, any overlap or stray write shows */
+static unsigned char tag_of(const void *ptr)
+{
+	return (unsigned char)(((uintptr_t)ptr >> 4) ^ 0x5A);
+}
+
+static void stamp(void *ptr, size_t size)
+{
+	memset(ptr, tag_of(ptr), size);
+}
+
+static void check(const void *ptr, size_t size)
+{
+	const unsigned char *bytes	= (const unsigned char*)ptr;
+	const unsigned char tag		= tag_of(ptr);
+
+	TEST_ASSERT(bytes[0] == tag && bytes[size / 2] == tag && bytes[size - 1] == tag,
+				"block was overwritten while live");
+}
+
+static void hop_cpu(size_t step)
+{
+	if (__cpus_g <= 1)
+		return;
+
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET((int)(step % (size_t)__cpus_g), &set);
+
+	/* Restricted cpusets may refuse, staying put is fine */
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+static int ring_push(ring_t *ring, void *ptr, size_t size)
+{
+	int pushed = 0;
+
+	pthread_mutex_lock(&ring->lock);
+
+	if (ring->head - ring->tail < TEST_RING)
+	{
+		ring->slots[ring->head % TEST_RING] = ptr;
+		ring->sizes[ring->head % TEST_RING] = size;
+		++ring->head;
+		pushed = 1;
+	}
+
+	pthread_mutex_unlock(&ring->lock);
+
+	return pushed;
+}
+
+static void ring_drain(ring_t *ring)
+{
+	pthread_mutex_lock(&ring->lock);
+
+	for (; ring->tail != ring->head; ++ring->tail)
+	{
+		void *ptr			= ring->slots[ring->tail % TEST_RING];
+		const size_t size	= ring->sizes[ring->tail % TEST_RING];
+
+		check(ptr, size);
+		lgfree(ptr);
+	}
+
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static void *thread_main(void *arg)
+{
+	const size_t id = (size_t)(uintptr_t)arg;
+
+	void	*live[TEST_LIVE]	= {0};
+	size_t	sizes[TEST_LIVE]	= {0};
+	size_t	seed				= id * 2654435761u + 1;
+
+	for (size_t i = 0; i < TEST_ITERATIONS; ++i)
+	{
+		seed = seed * 6364136223846793005u + 1442695040888963407u;
+
+		const size_t slot = (seed >> 33) % TEST_LIVE;
+		const size_t size = __sizes[(seed >> 17) % COUNT_OF(__sizes)];
+
+		if (live[slot])
+		{
+			check(live[slot], sizes[slot]);
+
+			/* Every other block is freed by the next thread */
+			if (!(i & 1) && ring_push(&__rings_g[(id + 1) % TEST_THREADS], live[slot], sizes[slot]))
+				live[slot] = NULL;
+			else
+				lgfree(live[slot]);
+		}
+
+		TEST_ASSERT(live[slot] = lgmalloc(size), "malloc failed");
+
+		sizes[slot] = size;
+		stamp(live[slot], size);
+
+		if (!(i % 512))
+		{
+			hop_cpu(id + i / 512);
+			ring_drain(&__rings_g[id]);
+		}
+	}
+
+	for (size_t slot = 0; slot < TEST_LIVE; ++slot)
+		if (live[slot])
+		{
+			check(live[slot], sizes[slot]);
+			lgfree_sized(live[slot], sizes[slot]);
+		}
+
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t threads[TEST_THREADS];
+
+	__cpus_g = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		pthread_mutex_init(&__rings_g[i].lock, NULL);
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		TEST_ASSERT(!pthread_create(&threads[i], NULL, thread_main, (void*)(uintptr_t)i),
+					"pthread_create failed");
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		pthread_join(threads[i], NULL);
+
+	for (size_t i = 0; i < TEST_THREADS; ++i)
+		ring_drain(&__rings_g[i]);
+
+	TEST_PASS();
+}
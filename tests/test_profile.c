@@ -0,0 +1,191 @@
+/* ******************************************** */
+/*                                              */
+/*   test_profile.c                             */
+/*                                              */
+/*   Author: https://github.com/Arty3           */
+/*                                              */
+/* ******************************************** */
+
+#include "lgmalloc.h"
+#include "lgtest.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Passed like the library build does, see the Makefile */
+#ifndef LGMALLOC_PROFILE_ENV
+#define LGMALLOC_PROFILE_ENV	"LGMALLOC_PROFILE"
+#endif
+
+#define TEST_PROFILE_MAGIC	0x504D474CU	/* "LGMP" */
+
+#define TEST_BLOCKS			4096
+#define TEST_RUNS			3
+
+static const size_t __sizes_g[] = { 24, 40, 100, 256, 1000, 4000 };
+
+#define TEST_SIZE_COUNT		(sizeof(__sizes_g) / sizeof(__sizes_g[0]))
+
+static void *__blocks_g[TEST_BLOCKS];
+
+/* What each child run allocates, so the profile
+ * it leaves behind has classes and sizes in it */
+static void run_workload(void)
+{
+	for (size_t i = 0; i < TEST_BLOCKS; ++i)
+	{
+		const size_t size = __sizes_g[i % TEST_SIZE_COUNT];
+
+		TEST_ASSERT(__blocks_g[i] = lgmalloc(size), "malloc failed");
+		memset(__blocks_g[i], (int)(i & 0xFF), size);
+	}
+
+	for (size_t i = 0; i < TEST_BLOCKS; ++i)
+	{
+		const size_t size = __sizes_g[i % TEST_SIZE_COUNT];
+		const unsigned char *bytes = (const unsigned char*)__blocks_g[i];
+
+		TEST_ASSERT(bytes[0] == (unsigned char)(i & 0xFF) &&
+					bytes[size - 1] == (unsigned char)(i & 0xFF),
+					"allocations overlap");
+
+		lgfree(__blocks_g[i]);
+	}
+}
+
+static void *run_worker(void *arg)
+{
+	(void)arg;
+
+	run_workload();
+
+	return NULL;
+}
+
+/* Runs this program again as a child with the
+ * profile environment variable pointing at path */
+static void run_child(const char *self, const char *path)
+{
+	const pid_t pid = fork();
+
+	TEST_ASSERT(pid >= 0, "fork failed");
+
+	if (!pid)
+	{
+		if (setenv(LGMALLOC_PROFILE_ENV, path, 1))
+			_exit(EXIT_FAILURE);
+
+		execl(self, self, "child", (char*)NULL);
+		_exit(EXIT_FAILURE);
+	}
+
+	int status;
+
+	TEST_ASSERT(waitpid(pid, &status, 0) == pid, "waitpid failed");
+	TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS,
+				"child run failed");
+}
+
+#if defined(LGMALLOC_ENABLE_PROFILING)
+
+/* The header starts with the magic and the version */
+static void check_profile(const char *path)
+{
+	uint32_t	header[2];
+	char		tmp[256];
+	FILE		*file = fopen(path, "rb");
+
+	TEST_ASSERT(file, "no profile written at exit");
+	TEST_ASSERT(fread(header, sizeof(header), 1, file) == 1, "profile truncated");
+
+	fclose(file);
+
+	TEST_ASSERT(header[0] == TEST_PROFILE_MAGIC, "profile has a bad magic");
+	TEST_ASSERT(header[1], "profile has no version");
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	TEST_ASSERT(access(tmp, F_OK), "temporary profile left behind");
+}
+
+/* Every run warm starts from the profile of the one
+ * before and writes a valid one back over it */
+static void test_round_trip(const char *self, const char *path)
+{
+	for (int run = 0; run < TEST_RUNS; ++run)
+	{
+		run_child(self, path);
+		check_profile(path);
+	}
+}
+
+/* Garbage in the profile is ignored on load, and
+ * replaced by a valid profile at exit */
+static void test_corrupt_profile(const char *self, const char *path)
+{
+	static const char garbage[] = "not an lgmalloc profile";
+
+	FILE *file = fopen(path, "wb");
+
+	TEST_ASSERT(file, "can't open the profile");
+	TEST_ASSERT(fwrite(garbage, sizeof(garbage), 1, file) == 1, "can't write the profile");
+
+	fclose(file);
+
+	run_child(self, path);
+	check_profile(path);
+}
+
+#else
+
+/* Without profiling the variable is never read */
+static void test_no_profile(const char *self, const char *path)
+{
+	run_child(self, path);
+	TEST_ASSERT(access(path, F_OK), "profile written without profiling");
+}
+
+#endif /* LGMALLOC_ENABLE_PROFILING */
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !strcmp(argv[1], "child"))
+	{
+		pthread_t thread;
+
+		/* A worker that exits first counts towards the profile too */
+		TEST_ASSERT(!pthread_create(&thread, NULL, run_worker, NULL), "pthread_create failed");
+		TEST_ASSERT(!pthread_join(thread, NULL), "pthread_join failed");
+
+		run_workload();
+		return EXIT_SUCCESS;
+	}
+
+	char self[256];
+	char path[] = "/tmp/lgmalloc_profile_XXXXXX";
+
+	const ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+
+	TEST_ASSERT(len > 0, "can't resolve /proc/self/exe");
+	self[len] = '\0';
+
+	/* Only a unique name, the first run starts cold */
+	const int fd = mkstemp(path);
+
+	TEST_ASSERT(fd >= 0, "mkstemp failed");
+	close(fd);
+	unlink(path);
+
+#if defined(LGMALLOC_ENABLE_PROFILING)
+	test_round_trip(self, path);
+	test_corrupt_profile(self, path);
+#else
+	test_no_profile(self, path);
+#endif
+
+	unlink(path);
+
+	TEST_PASS();
+}